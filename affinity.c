@@ -97,6 +97,186 @@ void thread_init(void)
 #endif
 }
 
+#ifdef TARGET_OS_WINDOWS
+static DWORD WINAPI thread_entry(LPVOID arg)
+#else
+static void *thread_entry(void *arg)
+#endif
+{
+    struct thread_handle *t = (struct thread_handle *)arg;
+
+    t->fn(t->arg);
+#ifdef TARGET_OS_WINDOWS
+    return 0;
+#else
+    return NULL;
+#endif
+}
+
+/*
+ * Start a thread running fn(arg).
+ *
+ * Returns zero on success, nonzero if the thread couldn't be started.
+ */
+int thread_start(struct thread_handle *t, thread_fn fn, void *arg)
+{
+    t->fn = fn;
+    t->arg = arg;
+#ifdef TARGET_OS_WINDOWS
+    t->handle = CreateThread(NULL, 0, thread_entry, t, 0, NULL);
+    return t->handle ? 0 : 1;
+#else
+    return pthread_create(&t->handle, NULL, thread_entry, t) ? 1 : 0;
+#endif
+}
+
+/*
+ * Wait for a thread from thread_start() to finish.
+ */
+void thread_join(struct thread_handle *t)
+{
+#ifdef TARGET_OS_WINDOWS
+    WaitForSingleObject(t->handle, INFINITE);
+    CloseHandle(t->handle);
+#else
+    pthread_join(t->handle, NULL);
+#endif
+}
+
+/*
+ * Number of CPUs currently online, or 1 if that can't be determined.
+ */
+uint32_t thread_cpu_count(void)
+{
+#ifdef TARGET_OS_WINDOWS
+    SYSTEM_INFO info;
+
+    GetSystemInfo(&info);
+    return info.dwNumberOfProcessors ? info.dwNumberOfProcessors : 1;
+#elif defined(_SC_NPROCESSORS_ONLN)
+    long count = sysconf(_SC_NPROCESSORS_ONLN);
+
+    return count > 0 ? (uint32_t)count : 1;
+#else
+    return 1;
+#endif
+}
+
+/*
+ * List the CPUs this process may run on into 'cpus', which has room for
+ * 'max' entries. Where the platform can say, that's the affinity mask the
+ * calling thread has, which leaves out CPUs held back by a cpuset or taskset
+ * and ones that are offline. Otherwise it's the first thread_cpu_count() ids.
+ *
+ * Returns the number of CPUs listed, which is at least one.
+ */
+uint32_t thread_allowed_cpus(uint32_t *cpus, uint32_t max)
+{
+    uint32_t count = 0, id;
+
+#if defined(TARGET_OS_LINUX) && defined(CPU_SET_S)
+    size_t setsize = CPU_ALLOC_SIZE(MAX_CPUS);
+    CPUSET_T *set = CPU_ALLOC(MAX_CPUS);
+
+    if (set) {
+        CPU_ZERO_S(setsize, set);
+        if (sched_getaffinity(0, setsize, set) == 0) {
+            for (id = 0; id < MAX_CPUS && count < max; id++) {
+                if (CPU_ISSET_S(id, setsize, set))
+                    cpus[count++] = id;
+            }
+        }
+        CPU_FREE(set);
+    }
+#elif defined(TARGET_OS_FREEBSD)
+    CPUSET_T set;
+
+    CPU_ZERO(&set);
+    if (cpuset_getaffinity(CPU_LEVEL_WHICH, CPU_WHICH_PID, -1, sizeof(set), &set) == 0) {
+        for (id = 0; id < CPU_SETSIZE && count < max; id++) {
+            if (CPU_ISSET(id, &set))
+                cpus[count++] = id;
+        }
+    }
+#endif
+
+    if (!count) {
+        count = thread_cpu_count();
+        if (count > max)
+            count = max;
+        for (id = 0; id < count; id++)
+            cpus[id] = id;
+    }
+    return count;
+}
+
+/*
+ * Physical package (socket) a CPU belongs to, or -1 if that can't be
+ * determined.
+ */
+int32_t thread_cpu_package(uint32_t id)
+{
+#ifdef TARGET_OS_LINUX
+    char path[128];
+    FILE *fp;
+    int package = -1;
+
+    snprintf(path, sizeof(path),
+             "/sys/devices/system/cpu/cpu%" PRIu32 "/topology/physical_package_id", id);
+    fp = fopen(path, "r");
+    if (!fp)
+        return -1;
+    if (fscanf(fp, "%d", &package) != 1)
+        package = -1;
+    fclose(fp);
+    return package;
+#else
+    (void)id;
+    return -1;
+#endif
+}
+
+/*
+ * Parse a list of CPUs like "0,2-5,8" into 'cpus', which has room for 'max'
+ * entries.
+ *
+ * Returns the number of CPUs in the list, or -1 if it is malformed, too long
+ * or names a CPU more than once.
+ */
+int thread_parse_cpus(const char *list, uint32_t *cpus, uint32_t max)
+{
+    uint32_t count = 0, idx;
+    unsigned long first, last;
+    char *end;
+
+    do {
+        first = strtoul(list, &end, 10);
+        if (end == list)
+            return -1;
+        last = first;
+        if (*end == '-') {
+            list = end + 1;
+            last = strtoul(list, &end, 10);
+            if (end == list || last < first)
+                return -1;
+        }
+        if (*end != ',' && *end != '\0')
+            return -1;
+        for (; first <= last; first++) {
+            if (count == max || first >= MAX_CPUS)
+                return -1;
+            for (idx = 0; idx < count; idx++) {
+                if (cpus[idx] == first)
+                    return -1;
+            }
+            cpus[count++] = (uint32_t)first;
+        }
+        list = end + 1;
+    } while (*end == ',');
+
+    return (int)count;
+}
+
 int thread_bind(uint32_t id)
 {
 #ifdef TARGET_OS_WINDOWS
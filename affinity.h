@@ -19,7 +19,33 @@
 
 #pragma once
 
+#ifndef TARGET_OS_WINDOWS
+#include <pthread.h>
+#endif
+
+typedef void (*thread_fn)(void *arg);
+
+/*
+ * A thread started with thread_start(). It must stay put until the thread
+ * is joined.
+ */
+struct thread_handle {
+#ifdef TARGET_OS_WINDOWS
+    HANDLE handle;
+#else
+    pthread_t handle;
+#endif
+    thread_fn fn;
+    void *arg;
+};
+
 void thread_init(void);
+int thread_start(struct thread_handle *t, thread_fn fn, void *arg);
+void thread_join(struct thread_handle *t);
+uint32_t thread_cpu_count(void);
+uint32_t thread_allowed_cpus(uint32_t *cpus, uint32_t max);
+int32_t thread_cpu_package(uint32_t id);
+int thread_parse_cpus(const char *list, uint32_t *cpus, uint32_t max);
 int thread_bind(uint32_t id);
 
 /* vim: set ts=4 sts=4 sw=4 noet: */
@@ -19,10 +19,22 @@
 
 #include "prefix.h"
 #include "clock.h"
+#include "convert.h"
+#include "perf.h"
+#include "stats.h"
+#include "vdso.h"
 
 #include <assert.h>
 #include <limits.h>
 
+#ifdef HAVE_DYNAMIC_CLOCKS
+#include <fcntl.h>
+
+#ifndef FD_TO_CLOCKID
+#define FD_TO_CLOCKID(fd)   ((~(clockid_t) (fd) << 3) | 3)
+#endif
+#endif
+
 struct clockspec tsc_ref_clock = { CPERF_NONE, 0 };
 struct clockspec ref_clock = { CPERF_NONE, 0 };
 
@@ -136,6 +148,182 @@ fail:
     return 1;
 }
 
+#if defined(TARGET_CPU_X86) || defined(TARGET_CPU_X86_64)
+#ifdef TARGET_COMPILER_MSVC
+#include <intrin.h>
+#endif
+
+int cpuid(uint32_t *_regs)
+{
+#ifdef TARGET_COMPILER_MSVC
+    __cpuidex((int *)_regs, _regs[0], _regs[2]);
+#else
+#ifdef TARGET_CPU_X86
+    static int cpuid_support = 0;
+    if (!cpuid_support) {
+        uint32_t pre_change, post_change;
+        const uint32_t id_flag = 0x200000;
+        asm ("pushfl\n\t"      /* Save %eflags to restore later.  */
+             "pushfl\n\t"      /* Push second copy, for manipulation.  */
+             "popl %1\n\t"     /* Pop it into post_change.  */
+             "movl %1,%0\n\t"  /* Save copy in pre_change.   */
+             "xorl %2,%1\n\t"  /* Tweak bit in post_change.  */
+             "pushl %1\n\t"    /* Push tweaked copy... */
+             "popfl\n\t"       /* ... and pop it into %eflags.  */
+             "pushfl\n\t"      /* Did it change?  Push new %eflags... */
+             "popl %1\n\t"     /* ... and pop it into post_change.  */
+             "popfl"           /* Restore original value.  */
+             : "=&r" (pre_change), "=&r" (post_change)
+             : "ir" (id_flag));
+        if (((pre_change ^ post_change) & id_flag) == 0)
+            return 1;
+        cpuid_support = 1;
+    }
+#endif
+    asm volatile(
+        "cpuid"
+        : "=a" (_regs[0]),
+          "=b" (_regs[1]),
+          "=c" (_regs[2]),
+          "=d" (_regs[3])
+        : "0" (_regs[0]), "2" (_regs[2]));
+#endif
+    return 0;
+}
+
+/*
+ * Serializing and ordered variants of RDTSC. A bare RDTSC can be executed
+ * out of order with respect to the surrounding instructions, so each of these
+ * trades some cost for tighter placement in the instruction stream.
+ */
+static int has_sse2;
+static int has_rdtscp;
+static int has_rdpru;
+
+static void cpu_clock_detect_ordered(void)
+{
+    uint32_t regs[4], max_ext;
+
+    memset(regs, 0, sizeof(regs));
+    if (cpuid(regs))
+        return;
+    if (regs[0] >= 1) {
+        memset(regs, 0, sizeof(regs));
+        regs[0] = 1;
+        cpuid(regs);
+        has_sse2 = (regs[3] & (1 << 26)) ? 1 : 0;
+    }
+
+    memset(regs, 0, sizeof(regs));
+    regs[0] = 0x80000000;
+    cpuid(regs);
+    max_ext = regs[0];
+
+    if (max_ext >= 0x80000001) {
+        memset(regs, 0, sizeof(regs));
+        regs[0] = 0x80000001;
+        cpuid(regs);
+        has_rdtscp = (regs[3] & (1 << 27)) ? 1 : 0;
+    }
+#ifndef TARGET_COMPILER_MSVC
+    if (max_ext >= 0x80000008) {
+        memset(regs, 0, sizeof(regs));
+        regs[0] = 0x80000008;
+        cpuid(regs);
+        has_rdpru = (regs[1] & (1 << 4)) ? 1 : 0;
+    }
+#endif
+}
+
+static int cpu_clock_ordered_supported(uint32_t major)
+{
+    switch (major) {
+    case CPERF_RDTSCP:
+        return has_rdtscp;
+    case CPERF_LFENCE_RDTSC:
+    case CPERF_RDTSC_LFENCE:
+    case CPERF_MFENCE_RDTSC:
+        return has_sse2;
+    case CPERF_RDPRU:
+        return has_rdpru;
+    default:
+        return 0;
+    }
+}
+
+static INLINE uint64_t cpu_clock_read_rdtscp(void)
+{
+#ifdef TARGET_COMPILER_MSVC
+    unsigned int aux;
+    return __rdtscp(&aux);
+#else
+    uint32_t lo, hi, aux;
+
+    __asm__ __volatile__("rdtscp" : "=a" (lo), "=d" (hi), "=c" (aux));
+    return ((uint64_t) hi << 32ULL) | lo;
+#endif
+}
+
+static INLINE uint64_t cpu_clock_read_lfence_rdtsc(void)
+{
+#ifdef TARGET_COMPILER_MSVC
+    _mm_lfence();
+    return __rdtsc();
+#else
+    uint32_t lo, hi;
+
+    __asm__ __volatile__("lfence\n\trdtsc" : "=a" (lo), "=d" (hi) :: "memory");
+    return ((uint64_t) hi << 32ULL) | lo;
+#endif
+}
+
+static INLINE uint64_t cpu_clock_read_rdtsc_lfence(void)
+{
+#ifdef TARGET_COMPILER_MSVC
+    uint64_t t = __rdtsc();
+    _mm_lfence();
+    return t;
+#else
+    uint32_t lo, hi;
+
+    __asm__ __volatile__("rdtsc\n\tlfence" : "=a" (lo), "=d" (hi) :: "memory");
+    return ((uint64_t) hi << 32ULL) | lo;
+#endif
+}
+
+static INLINE uint64_t cpu_clock_read_mfence_rdtsc(void)
+{
+#ifdef TARGET_COMPILER_MSVC
+    _mm_mfence();
+    return __rdtsc();
+#else
+    uint32_t lo, hi;
+
+    __asm__ __volatile__("mfence\n\trdtsc" : "=a" (lo), "=d" (hi) :: "memory");
+    return ((uint64_t) hi << 32ULL) | lo;
+#endif
+}
+
+/*
+ * AMD's RDPRU doesn't expose the TSC itself. ECX=0 selects MPERF, which
+ * counts at the P0 frequency (the TSC rate on parts with an invariant TSC)
+ * but only while the core is in C0. It is still useful as a comparison point
+ * for the cost of reading a counter without the RDTSC microcode.
+ */
+static INLINE uint64_t cpu_clock_read_rdpru(void)
+{
+#ifdef TARGET_COMPILER_MSVC
+    return 0;
+#else
+    uint32_t lo, hi;
+
+    /* Older assemblers don't know the mnemonic. */
+    __asm__ __volatile__(".byte 0x0f, 0x01, 0xfd" : "=a" (lo), "=d" (hi) : "c" (0));
+    return ((uint64_t) hi << 32ULL) | lo;
+#endif
+}
+#endif
+
 #if defined(TARGET_CPU_X86)
 static const char *cpu_clock_name(void)
 {
@@ -144,6 +332,7 @@ static const char *cpu_clock_name(void)
 
 void cpu_clock_init(void)
 {
+    cpu_clock_detect_ordered();
 }
 
 static INLINE uint64_t cpu_clock_read(void)
@@ -169,6 +358,7 @@ static const char *cpu_clock_name(void)
 
 void cpu_clock_init(void)
 {
+    cpu_clock_detect_ordered();
 }
 
 static INLINE uint64_t cpu_clock_read(void)
@@ -313,61 +503,119 @@ void cpu_clock_init(void)
 
 static unsigned long long cycles_per_msec;
 static unsigned long long cycles_start;
-static unsigned long long clock_mult;
-static unsigned long long max_cycles_mask;
-static unsigned long long nsecs_for_max_cycles;
-static unsigned int clock_shift;
-static unsigned int max_cycles_shift;
-#define MAX_CLOCK_SEC 60*60
-#define NR_TIME_ITERS 50
-
-static unsigned long get_cycles_per_msec(void)
-{
-#if defined(HAVE_KNOWN_TSC_FREQUENCY) && defined(TARGET_CPU_ARM) && TARGET_CPU_BITS == 64
-    return cntfrq_el0 / 1000;
-#else
-    uint64_t wc_s, wc_e;
-    uint64_t c_s, c_e;
-    uint64_t elapsed;
+static struct tsc_convert cpu_clock_conv;
+#define CALIBRATE_MAX_SAMPLES 4096
+#define CALIBRATE_BRACKET_TRIES 8
 
-    if (clock_read(tsc_ref_clock, &wc_s)) {
-        fprintf(stderr, "Reference clock '%s' died while measuring TSC frequency\n",
-                clock_name(tsc_ref_clock));
-        abort();
-    }
-    c_s = cpu_clock_read();
-    do {
-        if (clock_read(tsc_ref_clock, &wc_e)) {
-            fprintf(stderr, "Reference clock '%s' died while measuring TSC frequency\n",
-                    clock_name(tsc_ref_clock));
-            abort();
-        }
-        c_e = cpu_clock_read();
-        elapsed = wc_e - wc_s;
-        if (elapsed >= 1280000ULL) {
-            break;
+static int cpu_clock_calibrated;
+static const char *cycles_source;
+static uint32_t calibrate_window_ms = 100;
+static int calibrate_force;
+static struct cpu_clock_calibration calibration;
+
+#ifdef HAVE_CPU_CLOCK_ORDERED
+/*
+ * Ask the CPU for the TSC frequency. Leaf 0x15 gives the ratio of the TSC to
+ * the core crystal clock and, on most parts, the crystal frequency. When the
+ * crystal frequency is left as zero, the TSC runs at the processor base
+ * frequency from leaf 0x16, which is also what the kernel falls back to.
+ * Hypervisors may instead publish the TSC frequency in kHz in the generic
+ * timing leaf 0x40000010.
+ */
+static uint64_t cpu_clock_cpuid_hz(void)
+{
+    uint32_t regs[4], max_leaf;
+
+    memset(regs, 0, sizeof(regs));
+    if (cpuid(regs))
+        return 0;
+    max_leaf = regs[0];
+
+    if (max_leaf >= 0x15) {
+        memset(regs, 0, sizeof(regs));
+        regs[0] = 0x15;
+        cpuid(regs);
+        if (regs[0] && regs[1]) {
+            if (regs[2]) {
+                cycles_source = "cpuid 0x15";
+                return (uint64_t)regs[2] * regs[1] / regs[0];
+            }
+            if (max_leaf >= 0x16) {
+                memset(regs, 0, sizeof(regs));
+                regs[0] = 0x16;
+                cpuid(regs);
+                if (regs[0] & 0xffff) {
+                    cycles_source = "cpuid 0x15/0x16";
+                    return (uint64_t)(regs[0] & 0xffff) * 1000000ULL;
+                }
+            }
         }
-    } while (1);
+    }
 
-    return (c_e - c_s) * 1000000 / elapsed;
-#endif
+    memset(regs, 0, sizeof(regs));
+    regs[0] = 1;
+    cpuid(regs);
+    if (!(regs[2] & (1U << 31)))
+        return 0;
+
+    memset(regs, 0, sizeof(regs));
+    regs[0] = 0x40000000;
+    cpuid(regs);
+    if (regs[0] < 0x40000010)
+        return 0;
+
+    memset(regs, 0, sizeof(regs));
+    regs[0] = 0x40000010;
+    cpuid(regs);
+    if (!regs[0])
+        return 0;
+    cycles_source = "cpuid 0x40000010";
+    return (uint64_t)regs[0] * 1000ULL;
 }
+#endif
+
+#ifdef HAVE_PERF_TIMEBASE
+/*
+ * The kernel's own TSC to nanoseconds multiplier, as published for perf. It's
+ * only exposed when the kernel trusts the TSC, and it's derived from the
+ * kernel's tsc_khz, whether that came from CPUID (tsc_known_freq) or from the
+ * kernel's own refined calibration.
+ */
+static uint64_t cpu_clock_perf_hz(void)
+{
+    uint32_t mult;
+    uint16_t shift;
+    uint64_t zero;
 
-#ifndef min
-#define min(x,y) ({ \
-    __typeof__(x) _x = (x); \
-    __typeof__(y) _y = (y); \
-    (void) (&_x == &_y);        \
-    _x < _y ? _x : _y; })
+    if (perf_timebase_init() || perf_timebase_params(&mult, &shift, &zero) || !mult)
+        return 0;
+    cycles_source = "perf time_mult";
+    return (uint64_t)(1e9 * (double)(1ULL << shift) / (double)mult + 0.5);
+}
 #endif
 
-#ifndef max
-#define max(x,y) ({ \
-    __typeof__(x) _x = (x); \
-    __typeof__(y) _y = (y); \
-    (void) (&_x == &_y);        \
-    _x > _y ? _x : _y; })
+/*
+ * Look for a CPU clock frequency that someone else has already determined,
+ * so we can skip measuring it ourselves. Returns zero if none is known.
+ */
+static uint64_t cpu_clock_known_hz(void)
+{
+    uint64_t hz = 0;
+
+#ifdef HAVE_KNOWN_TSC_FREQUENCY
+    cycles_source = "cntfrq_el0";
+    hz = cntfrq_el0;
 #endif
+#ifdef HAVE_CPU_CLOCK_ORDERED
+    if (!hz)
+        hz = cpu_clock_cpuid_hz();
+#endif
+#ifdef HAVE_PERF_TIMEBASE
+    if (!hz)
+        hz = cpu_clock_perf_hz();
+#endif
+    return hz;
+}
 
 static void cpu_clock_init_ref(void)
 {
@@ -375,141 +623,452 @@ static void cpu_clock_init_ref(void)
     choose_ref_clock(&tsc_ref_clock, ref_clock_choices, for_clock);
 }
 
-void cpu_clock_calibrate(void)
+/*
+ * Take one (reference clock, CPU clock) pair. The reference read is
+ * bracketed by two CPU clock reads and the tightest of several brackets is
+ * kept, so a pair that straddled an interrupt doesn't make it into the fit.
+ */
+static void cpu_clock_sample(uint64_t *ref, uint64_t *cycles)
+{
+    uint64_t c0, c1, r, best = ~0ULL;
+    int i;
+
+    for (i = 0; i < CALIBRATE_BRACKET_TRIES; i++) {
+        c0 = cpu_clock_read();
+        if (tsc_ref_clock.major == CPERF_NONE || clock_read(tsc_ref_clock, &r)) {
+            fprintf(stderr, "Reference clock '%s' died while measuring TSC frequency\n",
+                    clock_name(tsc_ref_clock));
+            abort();
+        }
+        c1 = cpu_clock_read();
+        if (c1 - c0 < best) {
+            best = c1 - c0;
+            *ref = r;
+            *cycles = c0 + (c1 - c0) / 2;
+        }
+    }
+}
+
+/*
+ * Measure the CPU clock frequency against the reference clock, as the slope
+ * of a least-squares fit of CPU clock ticks over reference time. Samples are
+ * spread evenly across the calibration window, and a longer window gives a
+ * tighter fit. Returns the frequency in Hz.
+ */
+static double cpu_clock_measure(void)
 {
-    double delta, mean, S;
-    uint64_t minc, maxc, avg, cycles[NR_TIME_ITERS];
-    int i, samples, sft = 0;
-    unsigned long long tmp, max_ticks, max_mult;
+    static uint64_t refs[CALIBRATE_MAX_SAMPLES], cycles[CALIBRATE_MAX_SAMPLES];
+    struct linreg reg;
+    struct linreg_fit fit;
+    uint64_t interval, now;
+    double rough, x, resid, resid_max;
+    uint32_t i, n;
 
     cpu_clock_init_ref();
 
-    cycles[0] = get_cycles_per_msec();
-    S = delta = mean = 0.0;
-    for (i = 0; i < NR_TIME_ITERS; i++) {
-        cycles[i] = get_cycles_per_msec();
-        delta = cycles[i] - mean;
-        if (delta) {
-            mean += delta / (i + 1.0);
-            S += delta * (cycles[i] - mean);
-        }
+    n = CALIBRATE_MAX_SAMPLES;
+    if (calibrate_window_ms < CALIBRATE_MAX_SAMPLES / 4)
+        n = calibrate_window_ms * 4;
+    if (n < 64)
+        n = 64;
+    interval = calibrate_window_ms * 1000000ULL / n;
+
+    cpu_clock_sample(&refs[0], &cycles[0]);
+    for (i = 1; i < n; i++) {
+        do {
+            clock_read(tsc_ref_clock, &now);
+        } while (now - refs[0] < i * interval);
+        cpu_clock_sample(&refs[i], &cycles[i]);
     }
 
     /*
      * The most common platform clock breakage is returning zero
      * indefinitely. Check for that and return failure.
      */
-    if (!cycles[0] && !cycles[NR_TIME_ITERS - 1]) {
+    if (cycles[n - 1] == cycles[0] || refs[n - 1] == refs[0]) {
         fprintf(stderr, "CPU clock calibration failed!\n");
         abort();
     }
 
-    S = sqrt(S / (NR_TIME_ITERS - 1.0));
+    /*
+     * Fit against the endpoint-to-endpoint rate removed, so the residuals
+     * are computed from values of their own magnitude rather than as the
+     * tiny difference of two huge sums.
+     */
+    rough = (double)(cycles[n - 1] - cycles[0]) / ((double)(refs[n - 1] - refs[0]) * 1e-9);
+    linreg_init(&reg);
+    for (i = 0; i < n; i++) {
+        x = (double)(refs[i] - refs[0]) * 1e-9;
+        linreg_add(&reg, x, (double)(cycles[i] - cycles[0]) - rough * x);
+    }
+    if (linreg_solve(&reg, &fit) || rough + fit.slope <= 0.0) {
+        fprintf(stderr, "CPU clock calibration failed!\n");
+        abort();
+    }
 
-    minc = ~0ULL;
-    maxc = samples = avg = 0;
-    for (i = 0; i < NR_TIME_ITERS; i++) {
-        double this = (double)(cycles[i]);
+    resid_max = 0.0;
+    for (i = 0; i < n; i++) {
+        x = (double)(refs[i] - refs[0]) * 1e-9;
+        resid = (double)(cycles[i] - cycles[0]) - rough * x
+              - (fit.intercept + fit.slope * x);
+        resid_max = fmax(resid_max, fabs(resid));
+    }
+    fit.slope += rough;
 
-        minc = min(cycles[i], minc);
-        maxc = max(cycles[i], maxc);
+    calibration.window_ms = calibrate_window_ms;
+    calibration.samples = n;
+    calibration.hz = fit.slope;
+    calibration.ci_ppm = stats_t_interval(95.0, n - 2) * fit.slope_stderr / fit.slope * 1e6;
+    calibration.resid_stddev_ns = fit.resid_stddev / fit.slope * 1e9;
+    calibration.resid_max_ns = resid_max / fit.slope * 1e9;
 
-        if ((fmax(this, mean) - fmin(this, mean)) > S)
-            continue;
-        samples++;
-        avg += cycles[i];
+    return fit.slope;
+}
+
+/*
+ * Determine the CPU clock frequency and derive the conversion to
+ * nanoseconds. This only happens once. It has to happen before a CPU clock
+ * based clocksource is read, and before any other threads are started, as
+ * the reads don't check for it.
+ */
+void cpu_clock_calibrate(void)
+{
+    uint64_t known;
+    double hz;
+
+    if (cpu_clock_calibrated)
+        return;
+
+    known = cpu_clock_known_hz();
+    if (known >= 1000 && !calibrate_force) {
+        hz = (double)known;
+    } else {
+        if (known >= 1000) {
+            calibration.known_hz = (double)known;
+            calibration.known_source = cycles_source;
+        }
+        hz = cpu_clock_measure();
+        cycles_source = "measured";
     }
+    cycles_per_msec = (unsigned long long)(hz / 1000.0 + 0.5);
+    tsc_convert_init(&cpu_clock_conv, (uint64_t)(hz + 0.5));
+
+    cycles_start = cpu_clock_read();
+    cpu_clock_calibrated = 1;
+}
 
-    S /= (double) NR_TIME_ITERS;
+static INLINE void cpu_clock_ensure_calibrated(void)
+{
+    if (!cpu_clock_calibrated)
+        cpu_clock_calibrate();
+}
 
-    avg /= samples;
-    cycles_per_msec = avg;
+/*
+ * Measure the CPU clock frequency over a window of the given length, even if
+ * the frequency is already known from elsewhere. Must be called before the
+ * CPU clock is first used.
+ */
+void cpu_clock_set_calibration(uint32_t window_ms)
+{
+    calibrate_window_ms = window_ms;
+    calibrate_force = 1;
+}
 
-    max_ticks = MAX_CLOCK_SEC * cycles_per_msec * 1000ULL;
-    max_mult = ULLONG_MAX / max_ticks;
+/*
+ * Get the results of the CPU clock frequency measurement. Returns nonzero if
+ * the frequency was known up front and not measured.
+ */
+int cpu_clock_get_calibration(struct cpu_clock_calibration *out)
+{
+    cpu_clock_ensure_calibrated();
+    if (!calibration.samples)
+        return 1;
+    *out = calibration;
+    return 0;
+}
 
-    /*
-     * Find the largest shift count that will produce
-     * a multiplier that does not exceed max_mult
-     */
-    tmp = max_mult * cycles_per_msec / 1000000;
-    while (tmp > 1) {
-            tmp >>= 1;
-            sft++;
+/*
+ * Measure the CPU clock frequency against the reference clock and return it
+ * in Hz, even if the frequency conversions use was known up front. That one
+ * is then kept as the known frequency in the calibration results. Doesn't
+ * change the conversions.
+ */
+double cpu_clock_measure_hz(void)
+{
+    cpu_clock_ensure_calibrated();
+    if (!calibration.samples) {
+        calibration.known_hz = (double)cpu_clock_conv.hz;
+        calibration.known_source = cycles_source;
+        cpu_clock_measure();
     }
+    return calibration.hz;
+}
 
-    clock_shift = sft;
-    clock_mult = (1ULL << sft) * 1000000 / cycles_per_msec;
+/*
+ * Where the CPU clock frequency came from, e.g. "cpuid 0x15" or "measured".
+ */
+const char *cpu_clock_freq_source(void)
+{
+    cpu_clock_ensure_calibrated();
+    return cycles_source;
+}
 
-    /*
-     * Find the greatest power of 2 clock ticks that is less than the
-     * ticks in MAX_CLOCK_SEC_2STAGE
-     */
-    max_cycles_shift = max_cycles_mask = 0;
-    tmp = MAX_CLOCK_SEC * 1000ULL * cycles_per_msec;
-    while (tmp > 1) {
-        tmp >>= 1;
-        max_cycles_shift++;
-    }
-    /*
-     * if use use (1ULL << max_cycles_shift) * 1000 / cycles_per_msec
-     * here we will have a discontinuity every
-     * (1ULL << max_cycles_shift) cycles
-     */
-    nsecs_for_max_cycles = ((1ULL << max_cycles_shift) * clock_mult)
-                    >> clock_shift;
+/*
+ * Get the multiplier and shift used to convert CPU clock ticks to
+ * nanoseconds, i.e. ns = (ticks * mult) >> shift.
+ */
+int cpu_clock_mult_shift(uint64_t *mult, uint32_t *shift)
+{
+    cpu_clock_ensure_calibrated();
+    if (!cpu_clock_conv.mult)
+        return 1;
+    *mult = cpu_clock_conv.mult;
+    *shift = cpu_clock_conv.shift;
+    return 0;
+}
 
-    /* Use a bitmask to calculate ticks % (1ULL << max_cycles_shift) */
-    for (tmp = 0; tmp < max_cycles_shift; tmp++)
-        max_cycles_mask |= 1ULL << tmp;
+/*
+ * Get the CPU clock frequency in Hz that conversions to nanoseconds use.
+ */
+uint64_t cpu_clock_hz(void)
+{
+    cpu_clock_ensure_calibrated();
+    return cpu_clock_conv.hz;
+}
 
-    cycles_start = cpu_clock_read();
+/*
+ * Choose how CPU clock ticks are converted to nanoseconds. Returns nonzero if
+ * the engine isn't supported in this build.
+ */
+int cpu_clock_set_convert(uint32_t engine)
+{
+    if (!tsc_convert_supported(engine))
+        return 1;
+    cpu_clock_conv.engine = engine;
+    return 0;
 }
 #else
 void cpu_clock_calibrate(void)
 {
 }
-#endif
 
-/* Read a clock, in nanoseconds. */
-int clock_read(struct clockspec spec, uint64_t *output)
+const char *cpu_clock_freq_source(void)
 {
-    static uint64_t CLOCK_RATIO = 1000000000ULL / CLOCKS_PER_SEC;
-#ifdef TARGET_OS_WINDOWS
-    static LARGE_INTEGER qpc_freq;
-#endif
-#ifndef TARGET_COMPILER_MSVC
-    union {
-        struct timespec ts;
-        struct timeval tv;
-    } u;
+    return NULL;
+}
+
+double cpu_clock_measure_hz(void)
+{
+    return 0.0;
+}
+
+void cpu_clock_set_calibration(uint32_t window_ms)
+{
+    (void)window_ms;
+}
+
+int cpu_clock_get_calibration(struct cpu_clock_calibration *out)
+{
+    (void)out;
+    return 1;
+}
+
+uint64_t cpu_clock_hz(void)
+{
+    return 0;
+}
+
+int cpu_clock_set_convert(uint32_t engine)
+{
+    (void)engine;
+    return 1;
+}
+
+int cpu_clock_mult_shift(uint64_t *mult, uint32_t *shift)
+{
+    (void)mult;
+    (void)shift;
+    return 1;
+}
 #endif
-    switch(spec.major) {
+
 #ifdef HAVE_CLOCK_GETTIME
-        case CPERF_GETTIME:
-            if (clock_gettime(spec.minor, &u.ts) != 0)
-                return 1;
-            *output = (u.ts.tv_sec * 1000000000ULL) + u.ts.tv_nsec;
-            break;
+static INLINE uint64_t timespec_to_ns(const struct timespec *ts)
+{
+    return (ts->tv_sec * 1000000000ULL) + ts->tv_nsec;
+}
 #endif
+
 #ifdef HAVE_GETTIMEOFDAY
-        case CPERF_GTOD:
-            gettimeofday(&u.tv, NULL);
-            *output = (u.tv.tv_sec * 1000000000ULL) + (u.tv.tv_usec * 1000ULL);
-            break;
+static INLINE uint64_t timeval_to_ns(const struct timeval *tv)
+{
+    return (tv->tv_sec * 1000000000ULL) + (tv->tv_usec * 1000ULL);
+}
 #endif
+
 #ifdef HAVE_CPU_CLOCK
-        case CPERF_TSC:
-            {
-                uint64_t nsecs, t, multiples;
-                t = cpu_clock_read();
-                multiples = t >> max_cycles_shift;
-                nsecs = multiples * nsecs_for_max_cycles;
-                nsecs += ((t & max_cycles_mask) * clock_mult) >> clock_shift;
-                *output = nsecs;
-            }
-            break;
-#endif
+/*
+ * Convert with whichever engine is selected. This dispatches on the engine
+ * every time, which is fine for clock_read(), but the specialized loops below
+ * each use one engine directly.
+ */
+static INLINE uint64_t cpu_clock_to_ns(uint64_t t)
+{
+    return tsc_convert(&cpu_clock_conv, t);
+}
+#endif
+
+#if defined(HAVE_CPU_CLOCK) && defined(HAVE_PERF_TIMEBASE)
+/*
+ * Read the TSC and convert it to the kernel's perf clock, using the
+ * parameters the kernel publishes in the perf_event user page. The kernel
+ * can update them at any time, so they're read under the page's seqlock as
+ * described in linux/perf_event.h.
+ */
+static INLINE uint64_t perf_tsc_read(void)
+{
+    volatile struct perf_event_mmap_page *pc = perf_page;
+    uint64_t cyc, zero, quot, rem;
+    uint32_t seq, mult;
+    uint16_t shift;
+
+    do {
+        seq = pc->lock;
+        __asm__ __volatile__("" ::: "memory");
+        cyc = cpu_clock_read();
+        mult = pc->time_mult;
+        shift = pc->time_shift;
+        zero = pc->time_zero;
+        __asm__ __volatile__("" ::: "memory");
+    } while (pc->lock != seq);
+
+    quot = cyc >> shift;
+    rem = cyc & (((uint64_t)1 << shift) - 1);
+    return zero + quot * mult + ((rem * mult) >> shift);
+}
+#endif
+
+#ifdef HAVE_GETRUSAGE
+static INLINE uint64_t rusage_to_ns(const struct rusage *usage)
+{
+    return (usage->ru_utime.tv_sec * 1000000000ULL)
+        + (usage->ru_utime.tv_usec * 1000ULL)
+        + (usage->ru_stime.tv_sec * 1000000000ULL)
+        + (usage->ru_stime.tv_usec * 1000ULL);
+}
+#endif
+
+#ifdef TARGET_OS_WINDOWS
+static INLINE uint64_t filetime_to_ns(const FILETIME *ft)
+{
+    return ((uint64_t)ft->dwLowDateTime | ((uint64_t)ft->dwHighDateTime << 32)) * 100ULL;
+}
+#endif
+
+#ifdef HAVE_MACH_TIME
+static mach_timebase_info_data_t mach_tb;
+#endif
+#ifdef TARGET_OS_WINDOWS
+static LARGE_INTEGER qpc_freq;
+#endif
+
+/* Read a clock, in nanoseconds. */
+int clock_read(struct clockspec spec, uint64_t *output)
+{
+    static uint64_t CLOCK_RATIO = 1000000000ULL / CLOCKS_PER_SEC;
+#ifndef TARGET_COMPILER_MSVC
+    union {
+        struct timespec ts;
+        struct timeval tv;
+    } u;
+#endif
+    switch(spec.major) {
+        case CPERF_NONE:
+            /*
+             * Reads nothing, but still advances on every read, so timing it
+             * gives the cost of the harness around a clock read.
+             */
+            {
+                static uint64_t null_counter;
+                *output = ++null_counter;
+            }
+            break;
+#ifdef HAVE_CLOCK_GETTIME
+        case CPERF_GETTIME:
+            if (clock_gettime(spec.minor, &u.ts) != 0)
+                return 1;
+            *output = timespec_to_ns(&u.ts);
+            break;
+#endif
+#ifdef HAVE_GETTIMEOFDAY
+        case CPERF_GTOD:
+            gettimeofday(&u.tv, NULL);
+            *output = timeval_to_ns(&u.tv);
+            break;
+#endif
+#ifdef HAVE_VDSO
+        case CPERF_VDSO_GETTIME:
+            if (!vdso_clock_gettime || vdso_clock_gettime(spec.minor, &u.ts) != 0)
+                return 1;
+            *output = timespec_to_ns(&u.ts);
+            break;
+        case CPERF_VDSO_GTOD:
+            if (!vdso_gettimeofday || vdso_gettimeofday(&u.tv, NULL) != 0)
+                return 1;
+            *output = timeval_to_ns(&u.tv);
+            break;
+        case CPERF_VDSO_TIME:
+            if (!vdso_time)
+                return 1;
+            *output = vdso_time(NULL) * 1000000000ULL;
+            break;
+#endif
+#ifdef HAVE_SYSCALL_GETTIME
+        case CPERF_SYSCALL_GETTIME:
+            if (syscall(SYS_clock_gettime, spec.minor, &u.ts) != 0)
+                return 1;
+            *output = timespec_to_ns(&u.ts);
+            break;
+#endif
+#ifdef HAVE_CPU_CLOCK
+        case CPERF_TSC:
+            *output = cpu_clock_to_ns(cpu_clock_read());
+            break;
+#endif
+#if defined(HAVE_CPU_CLOCK) && defined(HAVE_PERF_TIMEBASE)
+        case CPERF_PERF_TSC:
+            if (!perf_page)
+                return 1;
+            *output = perf_tsc_read();
+            break;
+#endif
+#ifdef HAVE_CPU_CLOCK_ORDERED
+        case CPERF_RDTSCP:
+            if (!has_rdtscp)
+                return 1;
+            *output = cpu_clock_to_ns(cpu_clock_read_rdtscp());
+            break;
+        case CPERF_LFENCE_RDTSC:
+            if (!has_sse2)
+                return 1;
+            *output = cpu_clock_to_ns(cpu_clock_read_lfence_rdtsc());
+            break;
+        case CPERF_RDTSC_LFENCE:
+            if (!has_sse2)
+                return 1;
+            *output = cpu_clock_to_ns(cpu_clock_read_rdtsc_lfence());
+            break;
+        case CPERF_MFENCE_RDTSC:
+            if (!has_sse2)
+                return 1;
+            *output = cpu_clock_to_ns(cpu_clock_read_mfence_rdtsc());
+            break;
+        case CPERF_RDPRU:
+            if (!has_rdpru)
+                return 1;
+            *output = cpu_clock_to_ns(cpu_clock_read_rdpru());
+            break;
+#endif
         case CPERF_CLOCK:
             *output = clock() * CLOCK_RATIO;
             if (*output == 0)
@@ -521,10 +1080,7 @@ int clock_read(struct clockspec spec, uint64_t *output)
                 struct rusage usage;
                 if (getrusage(RUSAGE_SELF, &usage))
                     return 1;
-                *output = (usage.ru_utime.tv_sec * 1000000000ULL)
-                    + (usage.ru_utime.tv_usec * 1000ULL);
-                *output += (usage.ru_stime.tv_sec * 1000000000ULL)
-                    + (usage.ru_stime.tv_usec * 1000ULL);
+                *output = rusage_to_ns(&usage);
             }
             break;
 #endif
@@ -547,12 +1103,9 @@ int clock_read(struct clockspec spec, uint64_t *output)
 #endif
 #ifdef HAVE_MACH_TIME
         case CPERF_MACH_TIME:
-            {
-                static mach_timebase_info_data_t tb = {0, 0};
-                if (!tb.numer)
-                    mach_timebase_info(&tb);
-                *output = mach_absolute_time() * tb.numer / tb.denom;
-            }
+            if (!mach_tb.numer)
+                mach_timebase_info(&mach_tb);
+            *output = mach_absolute_time() * mach_tb.numer / mach_tb.denom;
             break;
 #endif
 #ifdef TARGET_OS_WINDOWS
@@ -581,7 +1134,7 @@ int clock_read(struct clockspec spec, uint64_t *output)
             {
                 FILETIME ft;
                 GetSystemTimeAsFileTime(&ft);
-                *output = ((uint64_t)ft.dwLowDateTime | ((uint64_t)ft.dwHighDateTime << 32)) * 100ULL;
+                *output = filetime_to_ns(&ft);
             }
             break;
 #if _WIN32_WINNT >= 0x0602
@@ -589,7 +1142,7 @@ int clock_read(struct clockspec spec, uint64_t *output)
             {
                 FILETIME ft;
                 GetSystemTimePreciseAsFileTime(&ft);
-                *output = ((uint64_t)ft.dwLowDateTime | ((uint64_t)ft.dwHighDateTime << 32)) * 100ULL;
+                *output = filetime_to_ns(&ft);
             }
             break;
 #endif
@@ -608,61 +1161,844 @@ int clock_read(struct clockspec spec, uint64_t *output)
     return 0;
 }
 
-const char *clock_name(struct clockspec spec)
+/*
+ * Specialized read loops.
+ *
+ * clock_read() has to go through a switch on the clock type for every
+ * reading, which is overhead that real users of these clocks never pay. The
+ * loops below are generated per clocksource (and per clock ID for
+ * clock_gettime), so the loop body is nothing but the clock read and its
+ * conversion to nanoseconds. Each clock gets three loops: one which sums the
+ * readings and hands the sum back to the caller (so the compiler can't
+ * discard them), one which stores every reading into a buffer, and one
+ * which does the same unrolled, so that independent reads can overlap in
+ * the pipeline as far as the clock allows.
+ */
+struct clock_loops {
+    uint64_t (*loop)(uint32_t minor, uint32_t iters);
+    void (*read_n)(uint32_t minor, uint64_t *out, size_t n);
+    void (*read_burst)(uint32_t minor, uint64_t *out, size_t n);
+    void (*read_raw_n)(uint32_t minor, void *raw, size_t n);
+    uint32_t raw_format;
+};
+
+/*
+ * 'minor' is passed through for clocks where the clock ID is only known at
+ * runtime. Loops which have it baked in ignore it.
+ */
+#define CLOCK_LOOP(name, read) \
+    CLOCK_LOOP_FUNCS(name, read) \
+    static const struct clock_loops clock_loops_##name = { \
+        clock_loop_##name, \
+        clock_read_n_##name, \
+        clock_read_burst_##name, \
+        NULL, \
+        CLOCK_RAW_NONE, \
+    };
+
+/*
+ * Clocks which can also be captured raw get a third loop, which stores the
+ * value the clock natively returns (of 'type', read into 'r' by 'read_raw')
+ * and leaves converting it with 'to_ns' for later.
+ */
+#define CLOCK_LOOP_RAW(name, type, format, read_raw, to_ns) \
+    CLOCK_LOOP_FUNCS(name, type r; read_raw; v = to_ns) \
+    static void clock_read_raw_n_##name(uint32_t minor, void *raw, size_t n) \
+    { \
+        type *out = (type *)raw; \
+        size_t i; \
+        (void)minor; \
+        for (i = 0; i < n; i++) { \
+            type r; \
+            read_raw; \
+            out[i] = r; \
+        } \
+    } \
+    static const struct clock_loops clock_loops_##name = { \
+        clock_loop_##name, \
+        clock_read_n_##name, \
+        clock_read_burst_##name, \
+        clock_read_raw_n_##name, \
+        format, \
+    };
+
+#define CLOCK_LOOP_FUNCS(name, read) \
+    static uint64_t clock_loop_##name(uint32_t minor, uint32_t iters) \
+    { \
+        uint64_t sum = 0, v; \
+        uint32_t i; \
+        (void)minor; \
+        for (i = 0; i < iters; i++) { \
+            read; \
+            sum += v; \
+        } \
+        return sum; \
+    } \
+    static void clock_read_n_##name(uint32_t minor, uint64_t *out, size_t n) \
+    { \
+        uint64_t v; \
+        size_t i; \
+        (void)minor; \
+        for (i = 0; i < n; i++) { \
+            read; \
+            out[i] = v; \
+        } \
+    } \
+    static void clock_read_burst_##name(uint32_t minor, uint64_t *out, size_t n) \
+    { \
+        size_t i; \
+        (void)minor; \
+        for (i = 0; i + 4 <= n; i += 4) { \
+            { uint64_t v; read; out[i] = v; } \
+            { uint64_t v; read; out[i + 1] = v; } \
+            { uint64_t v; read; out[i + 2] = v; } \
+            { uint64_t v; read; out[i + 3] = v; } \
+        } \
+        for (; i < n; i++) { \
+            uint64_t v; \
+            read; \
+            out[i] = v; \
+        } \
+    }
+
+#define CLOCK_LOOP_GETTIME(name, id) \
+    CLOCK_LOOP_RAW(gettime_##name, struct timespec, CLOCK_RAW_TIMESPEC, \
+        clock_gettime(id, &r), \
+        timespec_to_ns(&r))
+
+#ifdef HAVE_CLOCK_GETTIME
+/* For clock IDs only known at runtime, e.g. dynamic POSIX clocks. */
+CLOCK_LOOP_RAW(gettime, struct timespec, CLOCK_RAW_TIMESPEC,
+    clock_gettime(minor, &r),
+    timespec_to_ns(&r))
+#ifdef CLOCK_REALTIME
+CLOCK_LOOP_GETTIME(realtime, CLOCK_REALTIME)
+#endif
+#ifdef CLOCK_REALTIME_COARSE
+CLOCK_LOOP_GETTIME(realtime_coarse, CLOCK_REALTIME_COARSE)
+#endif
+#ifdef CLOCK_MONOTONIC
+CLOCK_LOOP_GETTIME(monotonic, CLOCK_MONOTONIC)
+#endif
+#ifdef CLOCK_MONOTONIC_COARSE
+CLOCK_LOOP_GETTIME(monotonic_coarse, CLOCK_MONOTONIC_COARSE)
+#endif
+#ifdef CLOCK_MONOTONIC_RAW
+CLOCK_LOOP_GETTIME(monotonic_raw, CLOCK_MONOTONIC_RAW)
+#endif
+#ifdef CLOCK_MONOTONIC_RAW_APPROX
+CLOCK_LOOP_GETTIME(monotonic_raw_approx, CLOCK_MONOTONIC_RAW_APPROX)
+#endif
+#ifdef CLOCK_BOOTTIME
+CLOCK_LOOP_GETTIME(boottime, CLOCK_BOOTTIME)
+#endif
+#ifdef CLOCK_TAI
+CLOCK_LOOP_GETTIME(tai, CLOCK_TAI)
+#endif
+#ifdef CLOCK_REALTIME_ALARM
+CLOCK_LOOP_GETTIME(realtime_alarm, CLOCK_REALTIME_ALARM)
+#endif
+#ifdef CLOCK_BOOTTIME_ALARM
+CLOCK_LOOP_GETTIME(boottime_alarm, CLOCK_BOOTTIME_ALARM)
+#endif
+#ifdef CLOCK_UPTIME_RAW
+CLOCK_LOOP_GETTIME(uptime_raw, CLOCK_UPTIME_RAW)
+#endif
+#ifdef CLOCK_UPTIME_RAW_APPROX
+CLOCK_LOOP_GETTIME(uptime_raw_approx, CLOCK_UPTIME_RAW_APPROX)
+#endif
+#ifdef CLOCK_PROCESS_CPUTIME_ID
+CLOCK_LOOP_GETTIME(process, CLOCK_PROCESS_CPUTIME_ID)
+#endif
+#ifdef CLOCK_THREAD_CPUTIME_ID
+CLOCK_LOOP_GETTIME(thread, CLOCK_THREAD_CPUTIME_ID)
+#endif
+#endif
+#ifdef HAVE_VDSO
+CLOCK_LOOP_RAW(vdso_gettime, struct timespec, CLOCK_RAW_TIMESPEC,
+    vdso_clock_gettime(minor, &r),
+    timespec_to_ns(&r))
+CLOCK_LOOP(vdso_gtod,
+    struct timeval tv;
+    vdso_gettimeofday(&tv, NULL);
+    v = timeval_to_ns(&tv))
+CLOCK_LOOP(vdso_time,
+    v = vdso_time(NULL) * 1000000000ULL)
+#endif
+#ifdef HAVE_SYSCALL_GETTIME
+CLOCK_LOOP_RAW(syscall_gettime, struct timespec, CLOCK_RAW_TIMESPEC,
+    syscall(SYS_clock_gettime, minor, &r),
+    timespec_to_ns(&r))
+#endif
+#ifdef HAVE_GETTIMEOFDAY
+CLOCK_LOOP(gtod,
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    v = timeval_to_ns(&tv))
+#endif
+#ifdef HAVE_CPU_CLOCK
+/*
+ * CPU clock loops are generated once per conversion engine, so picking the
+ * engine happens when the loops are looked up rather than on every read.
+ * The table is in the order of enum tsc_convert_engine.
+ */
+#define CLOCK_LOOP_TSC_ENGINE(name, engine, read_raw) \
+    CLOCK_LOOP_RAW(name##_##engine, uint64_t, CLOCK_RAW_TICKS, \
+        read_raw, \
+        tsc_convert_##engine(&cpu_clock_conv, r))
+
+#ifdef HAVE_INT128
+#define CLOCK_LOOP_TSC(name, read_raw) \
+    CLOCK_LOOP_TSC_ENGINE(name, two_stage, read_raw) \
+    CLOCK_LOOP_TSC_ENGINE(name, mul128, read_raw) \
+    CLOCK_LOOP_TSC_ENGINE(name, double, read_raw) \
+    CLOCK_LOOP_TSC_ENGINE(name, cyc2ns, read_raw) \
+    CLOCK_LOOP_TSC_ENGINE(name, reciprocal, read_raw) \
+    static const struct clock_loops *const clock_loops_##name[NUM_TSC_CONVERT] = { \
+        &clock_loops_##name##_two_stage, \
+        &clock_loops_##name##_mul128, \
+        &clock_loops_##name##_double, \
+        &clock_loops_##name##_cyc2ns, \
+        &clock_loops_##name##_reciprocal, \
+    };
+#else
+#define CLOCK_LOOP_TSC(name, read_raw) \
+    CLOCK_LOOP_TSC_ENGINE(name, two_stage, read_raw) \
+    CLOCK_LOOP_TSC_ENGINE(name, double, read_raw) \
+    CLOCK_LOOP_TSC_ENGINE(name, cyc2ns, read_raw) \
+    static const struct clock_loops *const clock_loops_##name[NUM_TSC_CONVERT] = { \
+        &clock_loops_##name##_two_stage, \
+        NULL, \
+        &clock_loops_##name##_double, \
+        &clock_loops_##name##_cyc2ns, \
+        NULL, \
+    };
+#endif
+
+CLOCK_LOOP_TSC(tsc,
+    r = cpu_clock_read())
+#endif
+#if defined(HAVE_CPU_CLOCK) && defined(HAVE_PERF_TIMEBASE)
+CLOCK_LOOP(perf_tsc,
+    v = perf_tsc_read())
+#endif
+#ifdef HAVE_CPU_CLOCK_ORDERED
+CLOCK_LOOP_TSC(rdtscp,
+    r = cpu_clock_read_rdtscp())
+CLOCK_LOOP_TSC(lfence_rdtsc,
+    r = cpu_clock_read_lfence_rdtsc())
+CLOCK_LOOP_TSC(rdtsc_lfence,
+    r = cpu_clock_read_rdtsc_lfence())
+CLOCK_LOOP_TSC(mfence_rdtsc,
+    r = cpu_clock_read_mfence_rdtsc())
+CLOCK_LOOP_TSC(rdpru,
+    r = cpu_clock_read_rdpru())
+#endif
+CLOCK_LOOP(clock,
+    v = clock() * (1000000000ULL / CLOCKS_PER_SEC))
+#ifdef HAVE_GETRUSAGE
+CLOCK_LOOP(rusage,
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    v = rusage_to_ns(&usage))
+#endif
+#ifdef HAVE_FTIME
+CLOCK_LOOP(ftime,
+    struct timeb time;
+    ftime(&time);
+    v = (time.time * 1000000000ULL) + (time.millitm * 1000000ULL))
+#endif
+#ifdef HAVE_TIME
+CLOCK_LOOP(time,
+    v = time(NULL) * 1000000000ULL)
+#endif
+#ifdef HAVE_MACH_TIME
+CLOCK_LOOP(mach_time,
+    v = mach_absolute_time() * mach_tb.numer / mach_tb.denom)
+#endif
+#ifdef TARGET_OS_WINDOWS
+CLOCK_LOOP(qpc,
+    LARGE_INTEGER qpc;
+    QueryPerformanceCounter(&qpc);
+    v = qpc.QuadPart * 1000000000ULL / qpc_freq.QuadPart)
+CLOCK_LOOP(gettickcount,
+    v = GetTickCount() * 1000000ULL)
+CLOCK_LOOP(gettickcount64,
+    v = GetTickCount64() * 1000000ULL)
+CLOCK_LOOP(timegettime,
+    v = timeGetTime() * 1000000ULL)
+CLOCK_LOOP(getsystime,
+    FILETIME ft;
+    GetSystemTimeAsFileTime(&ft);
+    v = filetime_to_ns(&ft))
+#if _WIN32_WINNT >= 0x0602
+CLOCK_LOOP(getsystimeprecise,
+    FILETIME ft;
+    GetSystemTimePreciseAsFileTime(&ft);
+    v = filetime_to_ns(&ft))
+#endif
+CLOCK_LOOP(unbiasedinttime,
+    ULONGLONG t;
+    QueryUnbiasedInterruptTime(&t);
+    v = t * 100ULL)
+#endif
+
+#ifdef HAVE_CPU_CLOCK
+/*
+ * Pick the CPU clock loops for the selected conversion engine.
+ */
+static const struct clock_loops *cpu_clock_loops(const struct clock_loops *const *engines)
+{
+    if (cpu_clock_conv.engine < NUM_TSC_CONVERT && engines[cpu_clock_conv.engine])
+        return engines[cpu_clock_conv.engine];
+    return engines[TSC_CONVERT_TWO_STAGE];
+}
+#endif
+
+static const struct clock_loops *clock_find_loops(struct clockspec spec)
 {
     switch(spec.major) {
-    case CPERF_NONE:
-        return "null";
+#ifdef HAVE_CLOCK_GETTIME
+        case CPERF_GETTIME:
+            switch(spec.minor) {
+#ifdef CLOCK_REALTIME
+            case CLOCK_REALTIME:
+                return &clock_loops_gettime_realtime;
+#endif
+#ifdef CLOCK_REALTIME_COARSE
+            case CLOCK_REALTIME_COARSE:
+                return &clock_loops_gettime_realtime_coarse;
+#endif
+#ifdef CLOCK_MONOTONIC
+            case CLOCK_MONOTONIC:
+                return &clock_loops_gettime_monotonic;
+#endif
+#ifdef CLOCK_MONOTONIC_COARSE
+            case CLOCK_MONOTONIC_COARSE:
+                return &clock_loops_gettime_monotonic_coarse;
+#endif
+#ifdef CLOCK_MONOTONIC_RAW
+            case CLOCK_MONOTONIC_RAW:
+                return &clock_loops_gettime_monotonic_raw;
+#endif
+#ifdef CLOCK_MONOTONIC_RAW_APPROX
+            case CLOCK_MONOTONIC_RAW_APPROX:
+                return &clock_loops_gettime_monotonic_raw_approx;
+#endif
+#ifdef CLOCK_BOOTTIME
+            case CLOCK_BOOTTIME:
+                return &clock_loops_gettime_boottime;
+#endif
+#ifdef CLOCK_TAI
+            case CLOCK_TAI:
+                return &clock_loops_gettime_tai;
+#endif
+#ifdef CLOCK_REALTIME_ALARM
+            case CLOCK_REALTIME_ALARM:
+                return &clock_loops_gettime_realtime_alarm;
+#endif
+#ifdef CLOCK_BOOTTIME_ALARM
+            case CLOCK_BOOTTIME_ALARM:
+                return &clock_loops_gettime_boottime_alarm;
+#endif
+#ifdef CLOCK_UPTIME_RAW
+            case CLOCK_UPTIME_RAW:
+                return &clock_loops_gettime_uptime_raw;
+#endif
+#ifdef CLOCK_UPTIME_RAW_APPROX
+            case CLOCK_UPTIME_RAW_APPROX:
+                return &clock_loops_gettime_uptime_raw_approx;
+#endif
+#ifdef CLOCK_PROCESS_CPUTIME_ID
+            case CLOCK_PROCESS_CPUTIME_ID:
+                return &clock_loops_gettime_process;
+#endif
+#ifdef CLOCK_THREAD_CPUTIME_ID
+            case CLOCK_THREAD_CPUTIME_ID:
+                return &clock_loops_gettime_thread;
+#endif
+            default:
+                return &clock_loops_gettime;
+            }
+            break;
+#endif
+#ifdef HAVE_VDSO
+        case CPERF_VDSO_GETTIME:
+            return vdso_clock_gettime ? &clock_loops_vdso_gettime : NULL;
+        case CPERF_VDSO_GTOD:
+            return vdso_gettimeofday ? &clock_loops_vdso_gtod : NULL;
+        case CPERF_VDSO_TIME:
+            return vdso_time ? &clock_loops_vdso_time : NULL;
+#endif
+#ifdef HAVE_SYSCALL_GETTIME
+        case CPERF_SYSCALL_GETTIME:
+            return &clock_loops_syscall_gettime;
+#endif
+#ifdef HAVE_GETTIMEOFDAY
+        case CPERF_GTOD:
+            return &clock_loops_gtod;
+#endif
+#ifdef HAVE_CPU_CLOCK
+        case CPERF_TSC:
+            return cpu_clock_loops(clock_loops_tsc);
+#endif
+#if defined(HAVE_CPU_CLOCK) && defined(HAVE_PERF_TIMEBASE)
+        case CPERF_PERF_TSC:
+            return perf_page ? &clock_loops_perf_tsc : NULL;
+#endif
+#ifdef HAVE_CPU_CLOCK_ORDERED
+        case CPERF_RDTSCP:
+            if (!has_rdtscp)
+                return NULL;
+            return cpu_clock_loops(clock_loops_rdtscp);
+        case CPERF_LFENCE_RDTSC:
+            if (!has_sse2)
+                return NULL;
+            return cpu_clock_loops(clock_loops_lfence_rdtsc);
+        case CPERF_RDTSC_LFENCE:
+            if (!has_sse2)
+                return NULL;
+            return cpu_clock_loops(clock_loops_rdtsc_lfence);
+        case CPERF_MFENCE_RDTSC:
+            if (!has_sse2)
+                return NULL;
+            return cpu_clock_loops(clock_loops_mfence_rdtsc);
+        case CPERF_RDPRU:
+            if (!has_rdpru)
+                return NULL;
+            return cpu_clock_loops(clock_loops_rdpru);
+#endif
+        case CPERF_CLOCK:
+            return &clock_loops_clock;
+#ifdef HAVE_GETRUSAGE
+        case CPERF_RUSAGE:
+            return &clock_loops_rusage;
+#endif
+#ifdef HAVE_FTIME
+        case CPERF_FTIME:
+            return &clock_loops_ftime;
+#endif
+#ifdef HAVE_TIME
+        case CPERF_TIME:
+            return &clock_loops_time;
+#endif
+#ifdef HAVE_MACH_TIME
+        case CPERF_MACH_TIME:
+            if (!mach_tb.numer)
+                mach_timebase_info(&mach_tb);
+            return &clock_loops_mach_time;
+#endif
+#ifdef TARGET_OS_WINDOWS
+        case CPERF_QUERYPERFCOUNTER:
+            if (!qpc_freq.QuadPart && !QueryPerformanceFrequency(&qpc_freq))
+                return NULL;
+            return &clock_loops_qpc;
+        case CPERF_GETTICKCOUNT:
+            return &clock_loops_gettickcount;
+        case CPERF_GETTICKCOUNT64:
+            return &clock_loops_gettickcount64;
+        case CPERF_TIMEGETTIME:
+            return &clock_loops_timegettime;
+        case CPERF_GETSYSTIME:
+            return &clock_loops_getsystime;
+#if _WIN32_WINNT >= 0x0602
+        case CPERF_GETSYSTIMEPRECISE:
+            return &clock_loops_getsystimeprecise;
+#endif
+        case CPERF_UNBIASEDINTTIME:
+            return &clock_loops_unbiasedinttime;
+#endif
+        default:
+            break;
+    }
 
-    case CPERF_GETTIME:
-        switch(spec.minor) {
+    return NULL;
+}
+
+/*
+ * Read a clock 'iters' times using its specialized read loop. The clock is
+ * only selected once, before the loop starts. The sum of all readings is
+ * stored in 'sink'.
+ *
+ * Returns zero on success, nonzero if the clock has no specialized loop.
+ */
+int clock_read_loop(struct clockspec spec, uint32_t iters, uint64_t *sink)
+{
+    const struct clock_loops *loops = clock_find_loops(spec);
+
+    if (!loops)
+        return 1;
+
+    *sink = loops->loop(spec.minor, iters);
+    return 0;
+}
+
+/*
+ * Fill 'out' with 'n' back-to-back readings of a clock, in nanoseconds. The
+ * clock is only selected once, and the loop doing the reads has no branches
+ * or error checks, so the readings are as close together as the clock
+ * allows. Clocks which fail intermittently will leave garbage in the buffer.
+ *
+ * Returns zero on success, nonzero if the clock has no specialized loop.
+ */
+int clock_read_n(struct clockspec spec, uint64_t *out, size_t n)
+{
+    const struct clock_loops *loops = clock_find_loops(spec);
+
+    if (!loops)
+        return 1;
+
+    loops->read_n(spec.minor, out, n);
+    return 0;
+}
+
+/*
+ * Like clock_read_n(), but with the loop unrolled, so that nothing but the
+ * clock itself keeps successive reads from overlapping. Timing this gives the
+ * clock's throughput rather than its latency.
+ *
+ * Returns zero on success, nonzero if the clock has no specialized loop.
+ */
+int clock_read_burst(struct clockspec spec, uint64_t *out, size_t n)
+{
+    const struct clock_loops *loops = clock_find_loops(spec);
+
+    if (!loops)
+        return 1;
+
+    loops->read_burst(spec.minor, out, n);
+    return 0;
+}
+
+/*
+ * Size in bytes of one raw reading from a clock, or zero if the clock can't
+ * be captured raw.
+ */
+size_t clock_raw_size(struct clockspec spec)
+{
+    const struct clock_loops *loops = clock_find_loops(spec);
+
+    if (!loops)
+        return 0;
+    switch (loops->raw_format) {
+    case CLOCK_RAW_TICKS:
+        return sizeof(uint64_t);
+#ifdef HAVE_CLOCK_GETTIME
+    case CLOCK_RAW_TIMESPEC:
+        return sizeof(struct timespec);
+#endif
+    default:
+        return 0;
+    }
+}
+
+/*
+ * Like clock_read_n(), but stores the values the clock natively returns
+ * (CPU clock ticks, struct timespec) instead of nanoseconds, leaving the
+ * conversion out of the loop. 'raw' must hold 'n' readings of
+ * clock_raw_size() bytes each.
+ *
+ * Returns zero on success, nonzero if the clock can't be captured raw.
+ */
+int clock_read_raw_n(struct clockspec spec, void *raw, size_t n)
+{
+    const struct clock_loops *loops = clock_find_loops(spec);
+
+    if (!loops || !loops->read_raw_n)
+        return 1;
+
+    loops->read_raw_n(spec.minor, raw, n);
+    return 0;
+}
+
+/*
+ * Look up a clock's raw read loop once, for callers that take raw readings
+ * one at a time and can't afford the lookup on every reading. Call it with
+ * the clock's minor. Returns NULL if the clock can't be captured raw.
+ */
+clock_raw_reader clock_find_raw_reader(struct clockspec spec)
+{
+    const struct clock_loops *loops = clock_find_loops(spec);
+
+    return loops ? loops->read_raw_n : NULL;
+}
+
+/*
+ * Convert 'n' raw readings from clock_read_raw_n() to nanoseconds, with the
+ * vectorized bulk conversions where there are any.
+ */
+int clock_raw_to_ns(struct clockspec spec, const void *raw, uint64_t *out, size_t n)
+{
+    const struct clock_loops *loops = clock_find_loops(spec);
+
+    if (!loops)
+        return 1;
+    switch (loops->raw_format) {
+#ifdef HAVE_CPU_CLOCK
+    case CLOCK_RAW_TICKS:
+        tsc_convert_bulk(&cpu_clock_conv, (const uint64_t *)raw, out, n);
+        return 0;
+#endif
+#ifdef HAVE_CLOCK_GETTIME
+    case CLOCK_RAW_TIMESPEC:
+        timespec_to_ns_bulk((const struct timespec *)raw, out, n);
+        return 0;
+#endif
+    default:
+        return 1;
+    }
+}
+
+#ifdef HAVE_DYNAMIC_CLOCKS
+#define MAX_DYNAMIC_CLOCKS 16
+
+static struct {
+    uint32_t minor;
+    char name[16];
+} dynamic_clocks[MAX_DYNAMIC_CLOCKS];
+static size_t dynamic_clock_count;
+
+static const char *dynamic_clock_name(uint32_t minor)
+{
+    size_t i;
+
+    for (i = 0; i < dynamic_clock_count; i++) {
+        if (dynamic_clocks[i].minor == minor)
+            return dynamic_clocks[i].name;
+    }
+    return NULL;
+}
+
+/*
+ * Open the dynamic POSIX clocks exposed by PTP hardware clocks (/dev/ptpN).
+ * These are read with clock_gettime() using a clock ID derived from the open
+ * file descriptor, which stays open for the life of the program. Devices we
+ * can't open or read are skipped.
+ *
+ * Returns the number of clocks stored in 'specs'.
+ */
+size_t clock_open_dynamic(struct clockspec *specs, size_t max)
+{
+    size_t count = 0;
+    uint32_t i;
+
+    for (i = 0; i < MAX_DYNAMIC_CLOCKS && count < max; i++) {
+        struct timespec ts;
+        char path[32];
+        clockid_t id;
+        int fd;
+
+        snprintf(path, sizeof(path), "/dev/ptp%u", i);
+        fd = open(path, O_RDONLY | O_CLOEXEC);
+        if (fd < 0)
+            continue;
+
+        id = FD_TO_CLOCKID(fd);
+        if (clock_gettime(id, &ts) != 0) {
+            close(fd);
+            continue;
+        }
+
+        dynamic_clocks[dynamic_clock_count].minor = (uint32_t)id;
+        snprintf(dynamic_clocks[dynamic_clock_count].name,
+                 sizeof(dynamic_clocks[dynamic_clock_count].name), "ptp%u", i);
+        dynamic_clock_count++;
+
+        specs[count].major = CPERF_GETTIME;
+        specs[count].minor = (uint32_t)id;
+        count++;
+    }
+
+    return count;
+}
+#endif
+
+static const char *gettime_name(uint32_t minor)
+{
+    switch(minor) {
 #ifdef CLOCK_REALTIME
-        case CLOCK_REALTIME:
-            return "realtime";
+    case CLOCK_REALTIME:
+        return "realtime";
 #endif
 #ifdef CLOCK_REALTIME_COARSE
-        case CLOCK_REALTIME_COARSE:
-            return "realtime_crs";
+    case CLOCK_REALTIME_COARSE:
+        return "realtime_crs";
 #endif
 #ifdef CLOCK_MONOTONIC
-        case CLOCK_MONOTONIC:
-            return "monotonic";
+    case CLOCK_MONOTONIC:
+        return "monotonic";
 #endif
 #ifdef CLOCK_MONOTONIC_COARSE
-        case CLOCK_MONOTONIC_COARSE:
-            return "monotonic_crs";
+    case CLOCK_MONOTONIC_COARSE:
+        return "monotonic_crs";
 #endif
 #ifdef CLOCK_MONOTONIC_RAW
-        case CLOCK_MONOTONIC_RAW:
-            return "monotonic_raw";
+    case CLOCK_MONOTONIC_RAW:
+        return "monotonic_raw";
 #endif
 #ifdef CLOCK_MONOTONIC_RAW_APPROX // OS X
-        case CLOCK_MONOTONIC_RAW_APPROX:
-            return "monotonic_raw_approx";
+    case CLOCK_MONOTONIC_RAW_APPROX:
+        return "monotonic_raw_approx";
 #endif
 #ifdef CLOCK_BOOTTIME
-        case CLOCK_BOOTTIME:
-            return "boottime";
+    case CLOCK_BOOTTIME:
+        return "boottime";
+#endif
+#ifdef CLOCK_TAI
+    case CLOCK_TAI:
+        return "tai";
+#endif
+#ifdef CLOCK_REALTIME_ALARM
+    case CLOCK_REALTIME_ALARM:
+        return "realtime_alarm";
+#endif
+#ifdef CLOCK_BOOTTIME_ALARM
+    case CLOCK_BOOTTIME_ALARM:
+        return "boottime_alarm";
 #endif
 #ifdef CLOCK_UPTIME_RAW // OS X
-        case CLOCK_UPTIME_RAW:
-            return "uptime_raw";
+    case CLOCK_UPTIME_RAW:
+        return "uptime_raw";
 #endif
 #ifdef CLOCK_UPTIME_RAW_APPROX // OS X
-        case CLOCK_UPTIME_RAW_APPROX:
-            return "uptime_raw_approx";
+    case CLOCK_UPTIME_RAW_APPROX:
+        return "uptime_raw_approx";
 #endif
+#ifdef CLOCK_PROCESS_CPUTIME_ID
+    case CLOCK_PROCESS_CPUTIME_ID:
+        return "process";
+#endif
+#ifdef CLOCK_THREAD_CPUTIME_ID
+    case CLOCK_THREAD_CPUTIME_ID:
+        return "thread";
+#endif
+    default:
+#ifdef HAVE_DYNAMIC_CLOCKS
+        return dynamic_clock_name(minor);
+#else
+        return NULL;
+#endif
+    }
+}
+
+/*
+ * Clocks which take a clock_gettime() clock ID through some other path (e.g.
+ * calling the vDSO directly) are named after the clock ID with a prefix. The
+ * names are built on first use and kept for the life of the program.
+ */
+static const char *gettime_name_prefixed(const char *prefix, uint32_t minor)
+{
+    static struct {
+        const char *prefix;
+        uint32_t minor;
+        char name[32];
+    } names[64];
+    static size_t count;
+    const char *base;
+    size_t i;
+
+    for (i = 0; i < count; i++) {
+        if (names[i].prefix == prefix && names[i].minor == minor)
+            return names[i].name;
+    }
+
+    base = gettime_name(minor);
+    if (!base)
+        return "unknown";
+    if (count == sizeof(names) / sizeof(names[0]))
+        abort();
+
+    names[count].prefix = prefix;
+    names[count].minor = minor;
+    snprintf(names[count].name, sizeof(names[count].name), "%s_%s", prefix, base);
+    return names[count++].name;
+}
+
+/*
+ * Whether the CPU has the instructions a clock is read with, as CPUID
+ * reports it. Only the ordered CPU clock variants depend on that, so every
+ * other clock counts as supported, though it may still fail when read.
+ */
+int clock_cpu_supported(struct clockspec spec)
+{
+    switch (spec.major) {
+#ifdef HAVE_CPU_CLOCK_ORDERED
+    case CPERF_RDTSCP:
+    case CPERF_LFENCE_RDTSC:
+    case CPERF_RDTSC_LFENCE:
+    case CPERF_MFENCE_RDTSC:
+    case CPERF_RDPRU:
+        return cpu_clock_ordered_supported(spec.major);
+#endif
+    default:
+        return 1;
+    }
+}
+
+/*
+ * Whether a clock counts CPU time used by the calling thread or process,
+ * rather than time passing. Readings of these from different threads can't
+ * be compared with each other.
+ */
+int clock_is_cpu_time(struct clockspec spec)
+{
+    switch (spec.major) {
+#ifdef HAVE_CLOCK_GETTIME
+    case CPERF_GETTIME:
+#ifdef HAVE_VDSO
+    case CPERF_VDSO_GETTIME:
+#endif
+#ifdef HAVE_SYSCALL_GETTIME
+    case CPERF_SYSCALL_GETTIME:
+#endif
+        switch (spec.minor) {
 #ifdef CLOCK_PROCESS_CPUTIME_ID
         case CLOCK_PROCESS_CPUTIME_ID:
-            return "process";
+            return 1;
 #endif
 #ifdef CLOCK_THREAD_CPUTIME_ID
         case CLOCK_THREAD_CPUTIME_ID:
-            return "thread";
+            return 1;
 #endif
         default:
-            abort();
+            return 0;
         }
+#endif
+    case CPERF_CLOCK:
+#ifdef HAVE_GETRUSAGE
+    case CPERF_RUSAGE:
+#endif
+        return 1;
+    default:
+        return 0;
+    }
+}
+
+const char *clock_name(struct clockspec spec)
+{
+    const char *name;
+
+    switch(spec.major) {
+    case CPERF_NONE:
+        return "null";
+
+    case CPERF_GETTIME:
+        name = gettime_name(spec.minor);
+        if (!name)
+            abort();
+        return name;
+#ifdef HAVE_VDSO
+    case CPERF_VDSO_GETTIME:
+        return gettime_name_prefixed("vdso", spec.minor);
+    case CPERF_VDSO_GTOD:
+        return "vdso_gettimeofday";
+    case CPERF_VDSO_TIME:
+        return "vdso_time";
+#endif
+#ifdef HAVE_SYSCALL_GETTIME
+    case CPERF_SYSCALL_GETTIME:
+        return gettime_name_prefixed("sys", spec.minor);
+#endif
 #ifdef HAVE_GETTIMEOFDAY
     case CPERF_GTOD:
         return "gettimeofday";
@@ -670,6 +2006,22 @@ const char *clock_name(struct clockspec spec)
 #ifdef HAVE_CPU_CLOCK
     case CPERF_TSC:
         return cpu_clock_name();
+#endif
+#if defined(HAVE_CPU_CLOCK) && defined(HAVE_PERF_TIMEBASE)
+    case CPERF_PERF_TSC:
+        return "perf_tsc";
+#endif
+#ifdef HAVE_CPU_CLOCK_ORDERED
+    case CPERF_RDTSCP:
+        return "rdtscp";
+    case CPERF_LFENCE_RDTSC:
+        return "lfence_rdtsc";
+    case CPERF_RDTSC_LFENCE:
+        return "rdtsc_lfence";
+    case CPERF_MFENCE_RDTSC:
+        return "mfence_rdtsc";
+    case CPERF_RDPRU:
+        return "rdpru";
 #endif
     case CPERF_CLOCK:
         return "clock";
@@ -742,6 +2094,9 @@ int clock_resolution(const struct clockspec spec, uint64_t *output)
             break;
 #ifdef HAVE_CLOCK_GETTIME
         case CPERF_GETTIME:
+#ifdef HAVE_SYSCALL_GETTIME
+        case CPERF_SYSCALL_GETTIME:
+#endif
             {
                 struct timespec ts;
                 if (clock_getres(spec.minor, &ts) != 0)
@@ -750,6 +2105,25 @@ int clock_resolution(const struct clockspec spec, uint64_t *output)
             }
             break;
 #endif
+#ifdef HAVE_VDSO
+        case CPERF_VDSO_GETTIME:
+            {
+                struct timespec ts;
+                if (!vdso_clock_gettime || clock_getres(spec.minor, &ts) != 0)
+                    return 1;
+                hz = 1000000000ULL / ((ts.tv_sec * 1000000000ULL) + ts.tv_nsec);
+            }
+            break;
+        case CPERF_VDSO_GTOD:
+            return 1;
+            break;
+        case CPERF_VDSO_TIME:
+            if (!vdso_time)
+                return 1;
+            /* 1 second granularity due to API design */
+            hz = 1ULL;
+            break;
+#endif
 #ifdef HAVE_GETTIMEOFDAY
         case CPERF_GTOD:
             return 1;
@@ -757,6 +2131,31 @@ int clock_resolution(const struct clockspec spec, uint64_t *output)
 #endif
 #ifdef HAVE_CPU_CLOCK
         case CPERF_TSC:
+            cpu_clock_ensure_calibrated();
+            hz = cycles_per_msec * 1000ULL;
+            break;
+#endif
+#if defined(HAVE_CPU_CLOCK) && defined(HAVE_PERF_TIMEBASE)
+        case CPERF_PERF_TSC:
+            {
+                uint32_t mult;
+                uint16_t shift;
+                uint64_t zero;
+                if (perf_timebase_params(&mult, &shift, &zero))
+                    return 1;
+                hz = (uint64_t)(1e9 * (double)(1ULL << shift) / (double)mult);
+            }
+            break;
+#endif
+#ifdef HAVE_CPU_CLOCK_ORDERED
+        case CPERF_RDTSCP:
+        case CPERF_LFENCE_RDTSC:
+        case CPERF_RDTSC_LFENCE:
+        case CPERF_MFENCE_RDTSC:
+        case CPERF_RDPRU:
+            if (!cpu_clock_ordered_supported(spec.major))
+                return 1;
+            cpu_clock_ensure_calibrated();
             hz = cycles_per_msec * 1000ULL;
             break;
 #endif
@@ -24,7 +24,17 @@ enum {
     CPERF_NONE,
     CPERF_GETTIME,
     CPERF_GTOD,
+    CPERF_VDSO_GETTIME,
+    CPERF_VDSO_GTOD,
+    CPERF_VDSO_TIME,
+    CPERF_SYSCALL_GETTIME,
     CPERF_TSC,
+    CPERF_RDTSCP,
+    CPERF_LFENCE_RDTSC,
+    CPERF_RDTSC_LFENCE,
+    CPERF_MFENCE_RDTSC,
+    CPERF_RDPRU,
+    CPERF_PERF_TSC,
     CPERF_CLOCK,
     CPERF_RUSAGE,
     CPERF_FTIME,
@@ -45,17 +55,70 @@ struct clockspec {
     uint32_t minor;
 };
 
+/*
+ * What a clock natively returns, for raw captures with clock_read_raw_n().
+ */
+enum {
+    CLOCK_RAW_NONE,
+    CLOCK_RAW_TICKS,        /* uint64_t CPU clock ticks */
+    CLOCK_RAW_TIMESPEC,     /* struct timespec */
+};
+
+/*
+ * Big enough to hold one raw reading of any format.
+ */
+union clock_raw {
+    uint64_t ticks;
+#ifdef HAVE_CLOCK_GETTIME
+    struct timespec ts;
+#endif
+};
+
+typedef void (*clock_raw_reader)(uint32_t minor, void *raw, size_t n);
+
 extern struct clockspec ref_clock;
 
 void clock_choose_ref(struct clockspec spec);
 void clock_choose_ref_wall(void);
 void clock_set_ref(struct clockspec spec);
 int clock_read(struct clockspec spec, uint64_t *output);
+int clock_read_loop(struct clockspec spec, uint32_t iters, uint64_t *sink);
+int clock_read_n(struct clockspec spec, uint64_t *out, size_t n);
+int clock_read_burst(struct clockspec spec, uint64_t *out, size_t n);
+size_t clock_raw_size(struct clockspec spec);
+int clock_read_raw_n(struct clockspec spec, void *raw, size_t n);
+clock_raw_reader clock_find_raw_reader(struct clockspec spec);
+int clock_raw_to_ns(struct clockspec spec, const void *raw, uint64_t *out, size_t n);
 const char *clock_name(struct clockspec spec);
+int clock_is_cpu_time(struct clockspec spec);
+int clock_cpu_supported(struct clockspec spec);
 int clock_resolution(const struct clockspec spec, uint64_t *output);
 
+/*
+ * Quality of a measured CPU clock frequency: the least-squares frequency,
+ * its 95% confidence interval, and the residuals of the fit. If the
+ * frequency was also known from elsewhere, that's recorded for comparison.
+ */
+struct cpu_clock_calibration {
+    uint32_t window_ms;
+    uint32_t samples;
+    double hz;
+    double ci_ppm;
+    double resid_stddev_ns;
+    double resid_max_ns;
+    double known_hz;
+    const char *known_source;
+};
+
 void cpu_clock_init(void);
 void cpu_clock_calibrate(void);
+int cpu_clock_mult_shift(uint64_t *mult, uint32_t *shift);
+const char *cpu_clock_freq_source(void);
+void cpu_clock_set_calibration(uint32_t window_ms);
+int cpu_clock_get_calibration(struct cpu_clock_calibration *out);
+double cpu_clock_measure_hz(void);
+uint64_t cpu_clock_hz(void);
+int cpu_clock_set_convert(uint32_t engine);
 
 #if    defined(TARGET_CPU_X86) \
     || defined(TARGET_CPU_X86_64) \
@@ -66,5 +129,13 @@ void cpu_clock_calibrate(void);
 #if defined(TARGET_CPU_ARM) && TARGET_CPU_BITS == 64
 #  define HAVE_KNOWN_TSC_FREQUENCY
 #endif
+#if defined(TARGET_OS_LINUX) && defined(HAVE_CLOCK_GETTIME)
+#  define HAVE_DYNAMIC_CLOCKS
+size_t clock_open_dynamic(struct clockspec *specs, size_t max);
+#endif
+#if defined(TARGET_CPU_X86) || defined(TARGET_CPU_X86_64)
+#  define HAVE_CPU_CLOCK_ORDERED
+int cpuid(uint32_t *regs);
+#endif
 
 /* vim: set ts=4 sts=4 sw=4 et: */
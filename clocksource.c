@@ -0,0 +1,91 @@
+/*
+ * clockperf
+ *
+ * Copyright (c) 2016-2021, Steven Noonan <steven@uplinklabs.net>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ */
+
+#include "prefix.h"
+#include "clocksource.h"
+
+#ifdef HAVE_KERNEL_CLOCKSOURCE
+
+#include <fcntl.h>
+
+#define CLOCKSOURCE_SYSFS "/sys/devices/system/clocksource/clocksource0/"
+
+/*
+ * These use plain open/read/write rather than stdio so that
+ * clocksource_set() can be used from a signal handler to restore the
+ * original clocksource.
+ */
+static int sysfs_read(const char *path, char *buf, size_t bufsz)
+{
+    ssize_t len;
+    int fd;
+
+    fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return 1;
+    len = read(fd, buf, bufsz - 1);
+    close(fd);
+    if (len <= 0)
+        return 1;
+
+    /* Trim trailing whitespace (sysfs adds a newline). */
+    while (len > 0 && (buf[len - 1] == '\n' || buf[len - 1] == ' '))
+        len--;
+    buf[len] = 0;
+    return 0;
+}
+
+/*
+ * Get the name of the clocksource the kernel is currently using for
+ * timekeeping, e.g. "tsc" or "hpet".
+ */
+int clocksource_current(char *buf, size_t bufsz)
+{
+    return sysfs_read(CLOCKSOURCE_SYSFS "current_clocksource", buf, bufsz);
+}
+
+/*
+ * Get the space-separated list of clocksources the kernel could switch to.
+ */
+int clocksource_available(char *buf, size_t bufsz)
+{
+    return sysfs_read(CLOCKSOURCE_SYSFS "available_clocksource", buf, bufsz);
+}
+
+/*
+ * Switch the kernel to a different clocksource. Requires root.
+ *
+ * Returns zero if the kernel accepted the change.
+ */
+int clocksource_set(const char *name)
+{
+    ssize_t len = (ssize_t)strlen(name), ret;
+    int fd;
+
+    fd = open(CLOCKSOURCE_SYSFS "current_clocksource", O_WRONLY);
+    if (fd < 0)
+        return 1;
+    ret = write(fd, name, len);
+    close(fd);
+    return ret == len ? 0 : 1;
+}
+
+#endif
+
+/* vim: set ts=4 sts=4 sw=4 et: */
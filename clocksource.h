@@ -0,0 +1,34 @@
+/*
+ * clockperf
+ *
+ * Copyright (c) 2016-2021, Steven Noonan <steven@uplinklabs.net>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ */
+
+#pragma once
+
+#include "platform.h"
+
+#ifdef TARGET_OS_LINUX
+#define HAVE_KERNEL_CLOCKSOURCE
+#endif
+
+#ifdef HAVE_KERNEL_CLOCKSOURCE
+int clocksource_current(char *buf, size_t bufsz);
+int clocksource_available(char *buf, size_t bufsz);
+int clocksource_set(const char *name);
+#endif
+
+/* vim: set ts=4 sts=4 sw=4 et: */
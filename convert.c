@@ -0,0 +1,662 @@
+/*
+ * clockperf
+ *
+ * Copyright (c) 2016-2021, Steven Noonan <steven@uplinklabs.net>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ */
+
+#include "prefix.h"
+#include "convert.h"
+
+#include <limits.h>
+
+#define MAX_CLOCK_SEC 60*60
+
+static const char *engine_names[NUM_TSC_CONVERT] = {
+    "two_stage",
+    "mul128",
+    "double",
+    "cyc2ns",
+    "reciprocal",
+};
+
+/*
+ * Derive the parameters for every engine from the CPU clock frequency, so the
+ * engine can be switched at any time.
+ */
+void tsc_convert_init(struct tsc_convert *c, uint64_t hz)
+{
+    unsigned long long cycles_per_msec, tmp, max_ticks, max_mult;
+    uint32_t sft = 0;
+
+    c->hz = hz;
+
+    /* TSC_CONVERT_TWO_STAGE */
+    cycles_per_msec = (hz + 500) / 1000;
+    max_ticks = MAX_CLOCK_SEC * cycles_per_msec * 1000ULL;
+    max_mult = ULLONG_MAX / max_ticks;
+
+    /*
+     * Find the largest shift count that will produce
+     * a multiplier that does not exceed max_mult
+     */
+    tmp = max_mult * cycles_per_msec / 1000000;
+    while (tmp > 1) {
+            tmp >>= 1;
+            sft++;
+    }
+
+    c->shift = sft;
+    c->mult = (uint64_t)((double)(1ULL << sft) * 1e9 / (double)hz + 0.5);
+
+    /*
+     * Find the greatest power of 2 clock ticks that is less than the
+     * ticks in MAX_CLOCK_SEC_2STAGE
+     */
+    c->max_cycles_shift = 0;
+    c->max_cycles_mask = 0;
+    tmp = MAX_CLOCK_SEC * 1000ULL * cycles_per_msec;
+    while (tmp > 1) {
+        tmp >>= 1;
+        c->max_cycles_shift++;
+    }
+    /*
+     * if use use (1ULL << max_cycles_shift) * 1000 / cycles_per_msec
+     * here we will have a discontinuity every
+     * (1ULL << max_cycles_shift) cycles
+     */
+    c->nsecs_for_max_cycles = ((1ULL << c->max_cycles_shift) * c->mult)
+                    >> c->shift;
+
+    /* Use a bitmask to calculate ticks % (1ULL << max_cycles_shift) */
+    for (tmp = 0; tmp < c->max_cycles_shift; tmp++)
+        c->max_cycles_mask |= 1ULL << tmp;
+
+    /* TSC_CONVERT_DOUBLE */
+    c->ns_per_tick = 1e9 / (double)hz;
+
+    /*
+     * TSC_CONVERT_CYC2NS, as clocks_calc_mult_shift() in the kernel does it
+     * with no range limit: the largest shift whose multiplier fits in 32 bits.
+     */
+    for (sft = 32; sft > 0; sft--) {
+        tmp = ((unsigned long long)1000000000ULL << sft) + hz / 2;
+        tmp /= hz;
+        if ((tmp >> 32) == 0)
+            break;
+    }
+    c->c2n_mult = (uint32_t)tmp;
+    c->c2n_shift = sft;
+
+#ifdef HAVE_INT128
+    /* TSC_CONVERT_MUL128: the largest shift whose multiplier fits in 64 bits. */
+    {
+        unsigned __int128 m = 0;
+
+        for (sft = 96; sft > 0; sft--) {
+            m = (((unsigned __int128)1000000000ULL << sft) + hz / 2) / hz;
+            if ((m >> 64) == 0)
+                break;
+        }
+        c->m128 = (uint64_t)m;
+        c->s128 = sft;
+    }
+
+    /* TSC_CONVERT_RECIPROCAL */
+    {
+        uint32_t l = 0;
+
+        while (l < 64 && (1ULL << l) < hz)
+            l++;
+        c->recip_shift = l;
+        c->recip = (uint64_t)((((unsigned __int128)((1ULL << l) - hz)) << 64) / hz) + 1;
+    }
+#endif
+}
+
+int tsc_convert_supported(uint32_t engine)
+{
+    switch (engine) {
+    case TSC_CONVERT_TWO_STAGE:
+    case TSC_CONVERT_DOUBLE:
+    case TSC_CONVERT_CYC2NS:
+        return 1;
+#ifdef HAVE_INT128
+    case TSC_CONVERT_MUL128:
+    case TSC_CONVERT_RECIPROCAL:
+        return 1;
+#endif
+    default:
+        return 0;
+    }
+}
+
+const char *tsc_convert_name(uint32_t engine)
+{
+    if (engine >= NUM_TSC_CONVERT)
+        return NULL;
+    return engine_names[engine];
+}
+
+/*
+ * Find an engine by name. Returns -1 if there's no such engine.
+ */
+int tsc_convert_lookup(const char *name)
+{
+    int i;
+
+    for (i = 0; i < NUM_TSC_CONVERT; i++) {
+        if (strcasecmp(name, engine_names[i]) == 0)
+            return i;
+    }
+    return -1;
+}
+
+/*
+ * Bulk conversion, for captures which store raw clock values and convert
+ * them afterward. The two_stage and cyc2ns engines only ever multiply by
+ * 32-bit quantities, which maps onto the 32x32->64 bit multiplies in SSE2
+ * and AVX2, so those get vectorized kernels producing exactly the same
+ * results as the scalar code. Everything else converts one value at a time.
+ */
+#if defined(HAVE_CPU_CLOCK_ORDERED) && defined(TARGET_COMPILER_GCC)
+#define HAVE_BULK_SIMD
+#endif
+
+enum {
+    BULK_SCALAR,
+    BULK_SSE2,
+    BULK_AVX2,
+};
+
+static int bulk_isa = -1;
+
+#ifdef HAVE_BULK_SIMD
+
+#include <immintrin.h>
+
+#define TARGET_SSE2 __attribute__((target("sse2")))
+#define TARGET_AVX2 __attribute__((target("avx2")))
+
+static uint64_t xgetbv0(void)
+{
+    uint32_t lo, hi;
+    __asm__ __volatile__("xgetbv" : "=a" (lo), "=d" (hi) : "c" (0));
+    return ((uint64_t)hi << 32) | lo;
+}
+
+static int bulk_detect(void)
+{
+    uint32_t regs[4], max_leaf;
+    int isa = BULK_SCALAR;
+
+    memset(regs, 0, sizeof(regs));
+    if (cpuid(regs))
+        return isa;
+    max_leaf = regs[0];
+    if (max_leaf < 1)
+        return isa;
+
+    memset(regs, 0, sizeof(regs));
+    regs[0] = 1;
+    cpuid(regs);
+    if (regs[3] & (1 << 26))
+        isa = BULK_SSE2;
+
+    /* AVX2 also needs the OS to save the YMM registers. */
+    if (max_leaf < 7 || !(regs[2] & (1 << 27)) || !(regs[2] & (1 << 28)))
+        return isa;
+    if ((xgetbv0() & 6) != 6)
+        return isa;
+
+    memset(regs, 0, sizeof(regs));
+    regs[0] = 7;
+    cpuid(regs);
+    if (regs[1] & (1 << 5))
+        isa = BULK_AVX2;
+    return isa;
+}
+
+/*
+ * Full 64-bit products of 64-bit lanes with a multiplier below 2^32, modulo
+ * 2^64, as the scalar code computes them.
+ */
+TARGET_AVX2 static INLINE __m256i mul64x32_avx2(__m256i a, __m256i b)
+{
+    __m256i lo = _mm256_mul_epu32(a, b);
+    __m256i hi = _mm256_mul_epu32(_mm256_srli_epi64(a, 32), b);
+    return _mm256_add_epi64(lo, _mm256_slli_epi64(hi, 32));
+}
+
+TARGET_SSE2 static INLINE __m128i mul64x32_sse2(__m128i a, __m128i b)
+{
+    __m128i lo = _mm_mul_epu32(a, b);
+    __m128i hi = _mm_mul_epu32(_mm_srli_epi64(a, 32), b);
+    return _mm_add_epi64(lo, _mm_slli_epi64(hi, 32));
+}
+
+TARGET_AVX2 static size_t two_stage_avx2(const struct tsc_convert *c, const uint64_t *in, uint64_t *out, size_t n)
+{
+    const __m256i mask = _mm256_set1_epi64x((long long)c->max_cycles_mask);
+    const __m256i mult = _mm256_set1_epi64x((long long)c->mult);
+    const __m256i span = _mm256_set1_epi64x((long long)c->nsecs_for_max_cycles);
+    const __m128i shift = _mm_cvtsi32_si128((int)c->shift);
+    const __m128i max_shift = _mm_cvtsi32_si128((int)c->max_cycles_shift);
+    size_t i;
+
+    for (i = 0; i + 4 <= n; i += 4) {
+        __m256i t = _mm256_loadu_si256((const __m256i *)&in[i]);
+        __m256i multiples = _mm256_srl_epi64(t, max_shift);
+        __m256i ns = mul64x32_avx2(span, multiples);
+        __m256i part = mul64x32_avx2(_mm256_and_si256(t, mask), mult);
+        ns = _mm256_add_epi64(ns, _mm256_srl_epi64(part, shift));
+        _mm256_storeu_si256((__m256i *)&out[i], ns);
+    }
+    return i;
+}
+
+TARGET_SSE2 static size_t two_stage_sse2(const struct tsc_convert *c, const uint64_t *in, uint64_t *out, size_t n)
+{
+    const __m128i mask = _mm_set1_epi64x((long long)c->max_cycles_mask);
+    const __m128i mult = _mm_set1_epi64x((long long)c->mult);
+    const __m128i span = _mm_set1_epi64x((long long)c->nsecs_for_max_cycles);
+    const __m128i shift = _mm_cvtsi32_si128((int)c->shift);
+    const __m128i max_shift = _mm_cvtsi32_si128((int)c->max_cycles_shift);
+    size_t i;
+
+    for (i = 0; i + 2 <= n; i += 2) {
+        __m128i t = _mm_loadu_si128((const __m128i *)&in[i]);
+        __m128i multiples = _mm_srl_epi64(t, max_shift);
+        __m128i ns = mul64x32_sse2(span, multiples);
+        __m128i part = mul64x32_sse2(_mm_and_si128(t, mask), mult);
+        ns = _mm_add_epi64(ns, _mm_srl_epi64(part, shift));
+        _mm_storeu_si128((__m128i *)&out[i], ns);
+    }
+    return i;
+}
+
+TARGET_AVX2 static size_t cyc2ns_avx2(const struct tsc_convert *c, const uint64_t *in, uint64_t *out, size_t n)
+{
+    const __m256i mult = _mm256_set1_epi64x(c->c2n_mult);
+    const __m128i shift = _mm_cvtsi32_si128((int)c->c2n_shift);
+    const __m128i hi_shift = _mm_cvtsi32_si128((int)(32 - c->c2n_shift));
+    size_t i;
+
+    for (i = 0; i + 4 <= n; i += 4) {
+        __m256i t = _mm256_loadu_si256((const __m256i *)&in[i]);
+        __m256i lo = _mm256_srl_epi64(_mm256_mul_epu32(t, mult), shift);
+        __m256i hi = _mm256_sll_epi64(_mm256_mul_epu32(_mm256_srli_epi64(t, 32), mult), hi_shift);
+        _mm256_storeu_si256((__m256i *)&out[i], _mm256_add_epi64(lo, hi));
+    }
+    return i;
+}
+
+TARGET_SSE2 static size_t cyc2ns_sse2(const struct tsc_convert *c, const uint64_t *in, uint64_t *out, size_t n)
+{
+    const __m128i mult = _mm_set1_epi64x(c->c2n_mult);
+    const __m128i shift = _mm_cvtsi32_si128((int)c->c2n_shift);
+    const __m128i hi_shift = _mm_cvtsi32_si128((int)(32 - c->c2n_shift));
+    size_t i;
+
+    for (i = 0; i + 2 <= n; i += 2) {
+        __m128i t = _mm_loadu_si128((const __m128i *)&in[i]);
+        __m128i lo = _mm_srl_epi64(_mm_mul_epu32(t, mult), shift);
+        __m128i hi = _mm_sll_epi64(_mm_mul_epu32(_mm_srli_epi64(t, 32), mult), hi_shift);
+        _mm_storeu_si128((__m128i *)&out[i], _mm_add_epi64(lo, hi));
+    }
+    return i;
+}
+
+#ifdef HAVE_CLOCK_GETTIME
+/*
+ * These assume a 64-bit tv_sec followed by a 64-bit tv_nsec, and are only
+ * used when struct timespec is laid out that way.
+ */
+TARGET_AVX2 static size_t timespec_avx2(const struct timespec *in, uint64_t *out, size_t n)
+{
+    const __m256i nsec_per_sec = _mm256_set1_epi64x(1000000000LL);
+    size_t i;
+
+    for (i = 0; i + 4 <= n; i += 4) {
+        __m256i a = _mm256_loadu_si256((const __m256i *)&in[i]);
+        __m256i b = _mm256_loadu_si256((const __m256i *)&in[i + 2]);
+        /* [s0 s2 | s1 s3] and [n0 n2 | n1 n3] */
+        __m256i sec = _mm256_unpacklo_epi64(a, b);
+        __m256i nsec = _mm256_unpackhi_epi64(a, b);
+        __m256i ns = _mm256_add_epi64(mul64x32_avx2(sec, nsec_per_sec), nsec);
+        ns = _mm256_permute4x64_epi64(ns, _MM_SHUFFLE(3, 1, 2, 0));
+        _mm256_storeu_si256((__m256i *)&out[i], ns);
+    }
+    return i;
+}
+
+TARGET_SSE2 static size_t timespec_sse2(const struct timespec *in, uint64_t *out, size_t n)
+{
+    const __m128i nsec_per_sec = _mm_set1_epi64x(1000000000LL);
+    size_t i;
+
+    for (i = 0; i + 2 <= n; i += 2) {
+        __m128i a = _mm_loadu_si128((const __m128i *)&in[i]);
+        __m128i b = _mm_loadu_si128((const __m128i *)&in[i + 1]);
+        __m128i sec = _mm_unpacklo_epi64(a, b);
+        __m128i nsec = _mm_unpackhi_epi64(a, b);
+        __m128i ns = _mm_add_epi64(mul64x32_sse2(sec, nsec_per_sec), nsec);
+        _mm_storeu_si128((__m128i *)&out[i], ns);
+    }
+    return i;
+}
+#endif
+
+#else
+
+static int bulk_detect(void)
+{
+    return BULK_SCALAR;
+}
+
+#endif
+
+static int bulk_get_isa(void)
+{
+    if (bulk_isa < 0)
+        bulk_isa = bulk_detect();
+    return bulk_isa;
+}
+
+const char *convert_bulk_isa(void)
+{
+    switch (bulk_get_isa()) {
+    case BULK_AVX2:
+        return "avx2";
+    case BULK_SSE2:
+        return "sse2";
+    default:
+        return "scalar";
+    }
+}
+
+/*
+ * Convert 'n' CPU clock readings to nanoseconds with the engine selected in
+ * 'c', giving the same results as tsc_convert() on each.
+ */
+void tsc_convert_bulk(const struct tsc_convert *c, const uint64_t *in, uint64_t *out, size_t n)
+{
+    size_t i = 0;
+
+#ifdef HAVE_BULK_SIMD
+    int isa = bulk_get_isa();
+
+    switch (c->engine) {
+    case TSC_CONVERT_TWO_STAGE:
+        /* The vector multiplies need 32-bit multipliers and span counts. */
+        if ((c->mult >> 32) || c->max_cycles_shift < 32)
+            break;
+        if (isa == BULK_AVX2)
+            i = two_stage_avx2(c, in, out, n);
+        else if (isa == BULK_SSE2)
+            i = two_stage_sse2(c, in, out, n);
+        break;
+    case TSC_CONVERT_CYC2NS:
+        if (isa == BULK_AVX2)
+            i = cyc2ns_avx2(c, in, out, n);
+        else if (isa == BULK_SSE2)
+            i = cyc2ns_sse2(c, in, out, n);
+        break;
+    default:
+        break;
+    }
+#endif
+
+    for (; i < n; i++)
+        out[i] = tsc_convert(c, in[i]);
+}
+
+#ifdef HAVE_CLOCK_GETTIME
+void timespec_to_ns_bulk(const struct timespec *in, uint64_t *out, size_t n)
+{
+    size_t i = 0;
+
+#ifdef HAVE_BULK_SIMD
+    if (sizeof(in->tv_sec) == 8 && sizeof(in->tv_nsec) == 8 && sizeof(*in) == 16) {
+        int isa = bulk_get_isa();
+
+        if (isa == BULK_AVX2)
+            i = timespec_avx2(in, out, n);
+        else if (isa == BULK_SSE2)
+            i = timespec_sse2(in, out, n);
+    }
+#endif
+
+    for (; i < n; i++)
+        out[i] = (in[i].tv_sec * 1000000000ULL) + in[i].tv_nsec;
+}
+#endif
+
+#ifdef HAVE_INT128
+
+#define BENCH_INPUTS 4096
+#define BENCH_REPS 4096
+#define ERROR_SAMPLES (1 << 22)
+
+static volatile uint64_t bench_sink;
+
+static uint64_t xorshift64(uint64_t *state)
+{
+    uint64_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    *state = x;
+    return x;
+}
+
+static uint64_t engine_convert(const struct tsc_convert *c, uint32_t engine, uint64_t t)
+{
+    switch (engine) {
+    case TSC_CONVERT_MUL128:
+        return tsc_convert_mul128(c, t);
+    case TSC_CONVERT_DOUBLE:
+        return tsc_convert_double(c, t);
+    case TSC_CONVERT_CYC2NS:
+        return tsc_convert_cyc2ns(c, t);
+    case TSC_CONVERT_RECIPROCAL:
+        return tsc_convert_reciprocal(c, t);
+    case TSC_CONVERT_TWO_STAGE:
+    default:
+        return tsc_convert_two_stage(c, t);
+    }
+}
+
+/*
+ * Time a loop of conversions through one engine. Each loop is specialized
+ * for its engine, so what's measured is the conversion and not the dispatch.
+ */
+#define BENCH_LOOP(fn) \
+    do { \
+        for (r = 0; r < BENCH_REPS; r++) \
+            for (i = 0; i < BENCH_INPUTS; i++) \
+                sum += fn(c, inputs[i]); \
+    } while (0)
+
+static int engine_cost(const struct tsc_convert *c, uint32_t engine,
+                       const uint64_t *inputs, struct clockspec ref, double *cost)
+{
+    uint64_t start, end, sum = 0;
+    uint32_t r, i;
+
+    if (clock_read(ref, &start))
+        return 1;
+    switch (engine) {
+    case TSC_CONVERT_MUL128:
+        BENCH_LOOP(tsc_convert_mul128);
+        break;
+    case TSC_CONVERT_DOUBLE:
+        BENCH_LOOP(tsc_convert_double);
+        break;
+    case TSC_CONVERT_CYC2NS:
+        BENCH_LOOP(tsc_convert_cyc2ns);
+        break;
+    case TSC_CONVERT_RECIPROCAL:
+        BENCH_LOOP(tsc_convert_reciprocal);
+        break;
+    case TSC_CONVERT_TWO_STAGE:
+    default:
+        BENCH_LOOP(tsc_convert_two_stage);
+        break;
+    }
+    if (clock_read(ref, &end))
+        return 1;
+    bench_sink = sum;
+
+    *cost = (double)(end - start) / ((double)BENCH_REPS * BENCH_INPUTS);
+    return 0;
+}
+
+/*
+ * Time bulk conversion of the inputs, through the engine in 'c' or, if 'c'
+ * is NULL, as struct timespec. Also checks that the results match converting
+ * each input on its own.
+ */
+static int bulk_cost(const struct tsc_convert *c, const uint64_t *inputs,
+                     struct clockspec ref, double *cost, int *match)
+{
+    static uint64_t out[BENCH_INPUTS];
+#ifdef HAVE_CLOCK_GETTIME
+    static struct timespec ts[BENCH_INPUTS];
+#endif
+    uint64_t start, end;
+    uint32_t r, i;
+
+#ifdef HAVE_CLOCK_GETTIME
+    for (i = 0; i < BENCH_INPUTS; i++) {
+        ts[i].tv_sec = inputs[i] / 1000000000ULL;
+        ts[i].tv_nsec = inputs[i] % 1000000000ULL;
+    }
+#endif
+
+    if (clock_read(ref, &start))
+        return 1;
+    for (r = 0; r < BENCH_REPS; r++) {
+#ifdef HAVE_CLOCK_GETTIME
+        if (!c) {
+            timespec_to_ns_bulk(ts, out, BENCH_INPUTS);
+            continue;
+        }
+#endif
+        tsc_convert_bulk(c, inputs, out, BENCH_INPUTS);
+    }
+    if (clock_read(ref, &end))
+        return 1;
+    *cost = (double)(end - start) / ((double)BENCH_REPS * BENCH_INPUTS);
+
+    *match = 1;
+    for (i = 0; i < BENCH_INPUTS; i++) {
+        uint64_t want = c ? tsc_convert(c, inputs[i]) : inputs[i];
+        if (out[i] != want)
+            *match = 0;
+    }
+    return 0;
+}
+
+/*
+ * Compare every engine against exact rational arithmetic, over tick counts
+ * spanning the given number of days at the given frequency, and time each
+ * one. Returns nonzero if the reference clock can't be read.
+ */
+int tsc_convert_bench(uint64_t hz, uint32_t days, struct clockspec ref)
+{
+    static uint64_t inputs[BENCH_INPUTS];
+    struct tsc_convert c;
+    uint64_t range, state = 0x9e3779b97f4a7c15ULL;
+    uint32_t e, i;
+
+    tsc_convert_init(&c, hz);
+    range = (uint64_t)days * 86400ULL * hz;
+
+    for (i = 0; i < BENCH_INPUTS; i++)
+        inputs[i] = xorshift64(&state) % range;
+
+    printf("== TSC Conversion Engines ==\n\n");
+    printf("Frequency %.6lf MHz, error over %" PRIu32 " days, cost timed with %s\n\n",
+            (double)hz / 1e6, days, clock_name(ref));
+    printf("Engine           Cost(ns)  MaxErr(ns)  MeanErr(ns)\n");
+
+    for (e = 0; e < NUM_TSC_CONVERT; e++) {
+        int64_t err, max_err = 0;
+        double mean_err = 0.0, cost;
+        uint64_t t;
+
+        /*
+         * Random points across the range, plus the very end of it, where
+         * precision is usually worst.
+         */
+        for (i = 0; i < ERROR_SAMPLES; i++) {
+            t = (i == 0) ? range : xorshift64(&state) % range;
+            err = (int64_t)(engine_convert(&c, e, t) - tsc_convert_exact(&c, t));
+            if (llabs(err) > llabs(max_err))
+                max_err = err;
+            mean_err += (double)err;
+        }
+        mean_err /= ERROR_SAMPLES;
+
+        if (engine_cost(&c, e, inputs, ref, &cost))
+            return 1;
+
+        printf("%-16s %8.2lf  %10" PRId64 "  %11.2lf\n",
+                tsc_convert_name(e), cost, max_err, mean_err);
+    }
+    printf("\n");
+
+    printf("Bulk (%s)%*s Cost(ns)  Matches\n", convert_bulk_isa(),
+            (int)(10 - strlen(convert_bulk_isa())), "");
+    for (e = 0; e < NUM_TSC_CONVERT; e++) {
+        double cost;
+        int match;
+
+        if (e != TSC_CONVERT_TWO_STAGE && e != TSC_CONVERT_CYC2NS)
+            continue;
+        c.engine = e;
+        if (bulk_cost(&c, inputs, ref, &cost, &match))
+            return 1;
+        printf("%-16s %8.2lf  %7s\n", tsc_convert_name(e), cost, match ? "Yes" : "No");
+    }
+#ifdef HAVE_CLOCK_GETTIME
+    {
+        double cost;
+        int match;
+
+        if (bulk_cost(NULL, inputs, ref, &cost, &match))
+            return 1;
+        printf("%-16s %8.2lf  %7s\n", "timespec", cost, match ? "Yes" : "No");
+    }
+#endif
+    printf("\n\n");
+    return 0;
+}
+
+#else
+
+int tsc_convert_bench(uint64_t hz, uint32_t days, struct clockspec ref)
+{
+    (void)hz;
+    (void)days;
+    (void)ref;
+    printf("error: conversion benchmarks need 128-bit integer support\n");
+    return 1;
+}
+
+#endif
+
+/* vim: set ts=4 sts=4 sw=4 et: */
@@ -0,0 +1,162 @@
+/*
+ * clockperf
+ *
+ * Copyright (c) 2016-2021, Steven Noonan <steven@uplinklabs.net>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ */
+
+#pragma once
+
+#include "platform.h"
+#include "clock.h"
+
+#if defined(__SIZEOF_INT128__)
+#  define HAVE_INT128
+#endif
+
+/*
+ * Ways to turn CPU clock ticks into nanoseconds. They trade precision and
+ * range against cost on the timestamping path.
+ */
+enum tsc_convert_engine {
+    TSC_CONVERT_TWO_STAGE,      /* fio-style mult/shift, split into fixed-size spans of ticks */
+    TSC_CONVERT_MUL128,         /* 64-bit multiplier, high half of a 128-bit product */
+    TSC_CONVERT_DOUBLE,         /* double-precision nanoseconds per tick */
+    TSC_CONVERT_CYC2NS,         /* the kernel's cyc2ns, 32-bit mult with a 96-bit product */
+    TSC_CONVERT_RECIPROCAL,     /* exact t * 1e9 / hz, dividing by a precomputed reciprocal */
+    NUM_TSC_CONVERT
+};
+
+struct tsc_convert {
+    uint32_t engine;
+    uint64_t hz;
+
+    /* TSC_CONVERT_TWO_STAGE */
+    uint64_t mult;
+    uint32_t shift;
+    uint32_t max_cycles_shift;
+    uint64_t max_cycles_mask;
+    uint64_t nsecs_for_max_cycles;
+
+    /* TSC_CONVERT_MUL128 */
+    uint64_t m128;
+    uint32_t s128;
+
+    /* TSC_CONVERT_DOUBLE */
+    double ns_per_tick;
+
+    /* TSC_CONVERT_CYC2NS */
+    uint32_t c2n_mult;
+    uint32_t c2n_shift;
+
+    /* TSC_CONVERT_RECIPROCAL */
+    uint64_t recip;
+    uint32_t recip_shift;
+};
+
+void tsc_convert_init(struct tsc_convert *c, uint64_t hz);
+int tsc_convert_supported(uint32_t engine);
+const char *tsc_convert_name(uint32_t engine);
+int tsc_convert_lookup(const char *name);
+int tsc_convert_bench(uint64_t hz, uint32_t days, struct clockspec ref);
+
+void tsc_convert_bulk(const struct tsc_convert *c, const uint64_t *in, uint64_t *out, size_t n);
+#ifdef HAVE_CLOCK_GETTIME
+void timespec_to_ns_bulk(const struct timespec *in, uint64_t *out, size_t n);
+#endif
+const char *convert_bulk_isa(void);
+
+static INLINE uint64_t tsc_convert_two_stage(const struct tsc_convert *c, uint64_t t)
+{
+    uint64_t nsecs, multiples;
+    multiples = t >> c->max_cycles_shift;
+    nsecs = multiples * c->nsecs_for_max_cycles;
+    nsecs += ((t & c->max_cycles_mask) * c->mult) >> c->shift;
+    return nsecs;
+}
+
+static INLINE uint64_t tsc_convert_double(const struct tsc_convert *c, uint64_t t)
+{
+    return (uint64_t)((double)t * c->ns_per_tick);
+}
+
+static INLINE uint64_t tsc_convert_cyc2ns(const struct tsc_convert *c, uint64_t t)
+{
+    uint64_t ns;
+
+    ns = ((uint64_t)(uint32_t)t * c->c2n_mult) >> c->c2n_shift;
+    ns += ((t >> 32) * c->c2n_mult) << (32 - c->c2n_shift);
+    return ns;
+}
+
+#ifdef HAVE_INT128
+static INLINE uint64_t tsc_convert_mul128(const struct tsc_convert *c, uint64_t t)
+{
+    return (uint64_t)(((unsigned __int128)t * c->m128) >> c->s128);
+}
+
+/*
+ * Unsigned division by an invariant divisor, from Granlund and Montgomery,
+ * "Division by Invariant Integers using Multiplication", figure 4.1.
+ */
+static INLINE uint64_t tsc_convert_div_hz(const struct tsc_convert *c, uint64_t n)
+{
+    uint64_t t1 = (uint64_t)(((unsigned __int128)n * c->recip) >> 64);
+    return (t1 + ((n - t1) >> 1)) >> (c->recip_shift - 1);
+}
+
+static INLINE uint64_t tsc_convert_reciprocal(const struct tsc_convert *c, uint64_t t)
+{
+    uint64_t sec, rem;
+
+    sec = tsc_convert_div_hz(c, t);
+    rem = t - sec * c->hz;
+    return sec * 1000000000ULL + tsc_convert_div_hz(c, rem * 1000000000ULL);
+}
+
+/*
+ * The exact answer, floor(t * 1e9 / hz), to judge the others against.
+ */
+static INLINE uint64_t tsc_convert_exact(const struct tsc_convert *c, uint64_t t)
+{
+    return (uint64_t)((unsigned __int128)t * 1000000000ULL / c->hz);
+}
+#endif
+
+/*
+ * Convert with the engine selected in 'c'. This switches on the engine for
+ * every call, so the specialized clock read loops call the engine-specific
+ * functions above instead.
+ */
+static INLINE uint64_t tsc_convert(const struct tsc_convert *c, uint64_t t)
+{
+    switch (c->engine) {
+#ifdef HAVE_INT128
+    case TSC_CONVERT_MUL128:
+        return tsc_convert_mul128(c, t);
+    case TSC_CONVERT_RECIPROCAL:
+        return tsc_convert_reciprocal(c, t);
+#endif
+    case TSC_CONVERT_DOUBLE:
+        return tsc_convert_double(c, t);
+    case TSC_CONVERT_CYC2NS:
+        return tsc_convert_cyc2ns(c, t);
+    case TSC_CONVERT_TWO_STAGE:
+    default:
+        return tsc_convert_two_stage(c, t);
+    }
+}
+
+/* vim: set ts=4 sts=4 sw=4 et: */
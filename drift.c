@@ -21,183 +21,476 @@
 #include "affinity.h"
 #include "clock.h"
 #include "drift.h"
+#include "stats.h"
+#include "sync.h"
 #include "util.h"
 
 #ifdef HAVE_DRIFT_TESTS
 
-#include <assert.h>
-#include <stdbool.h>
-#include <omp.h>
+#include <errno.h>
+#include <stddef.h>
+
+/*
+ * Per-CPU slots and the shared control word each get their own pair of
+ * cache lines, so the adjacent-line prefetcher doesn't drag a neighbour's
+ * slot along with them.
+ */
+#define DRIFT_SLOT_ALIGN 128
+
+/*
+ * How long a thread spins on the control word before going to sleep on it,
+ * in pause iterations. This has to comfortably cover DRIFT_ARM_US.
+ */
+#define DRIFT_SPIN_LIMIT (1U << 18)
+
+/*
+ * How long before each round the threads are woken up, so that they're
+ * already spinning when the round starts.
+ */
+#define DRIFT_ARM_US 200
+
+/*
+ * With shorter intervals, only print a round about this often. Every round
+ * still goes into the fits.
+ */
+#define DRIFT_PRINT_MS 1000
 
 struct global_cfg {
     struct clockspec clk;
     struct clockspec ref;
-};
 
-typedef enum {
-    UNSTARTED = 0,  // not yet spawned
-    WAITING = 1,    // waiting for requests from master
-    REPORTING = 2,  // thread asked to report in
-    EXITING = 3,    // thread asked to exit
-    DEAD = 4,       // thread exited
-} thread_state;
+    /* Bytes per raw reading, or zero to read in nanoseconds directly. */
+    size_t clk_raw_size;
+    size_t ref_raw_size;
 
-struct thread_ctx {
-    thread_state state;
+    /* Looked up once, so a raw reading doesn't go through clock_find_loops(). */
+    clock_raw_reader clk_read_raw;
+    clock_raw_reader ref_read_raw;
+};
+
+/*
+ * One per CPU. 'done' is the last round the thread reported for, and is
+ * released after the readings, so the master can read them once it sees it.
+ * The clock under test is read between two reference readings, which bound
+ * when it was taken.
+ */
+struct drift_slot {
+    SYNC_ALIGN(DRIFT_SLOT_ALIGN) sync_u32 done;
 
     uint64_t last_clk;
     uint64_t last_ref;
+    uint64_t last_ref_after;
 
-    char padding[104];         // padding to at least one L2 cache line wide
+    union clock_raw raw_clk;
+    union clock_raw raw_ref;
+    union clock_raw raw_ref_after;
 };
 
+/*
+ * The master bumps 'gen' to an odd value to wake the threads up ahead of a
+ * round, and to the next (even) value to start it. 'stop' is set before a
+ * final bump. 'bound' counts the threads that have tried to pin themselves
+ * to their CPU.
+ */
+struct drift_ctl {
+    SYNC_ALIGN(DRIFT_SLOT_ALIGN) sync_u32 gen;
+    sync_u32 stop;
+    sync_u32 bound;
+};
+
+struct drift_worker {
+    struct thread_handle thread;
+    uint32_t cpu;
+    int bind_failed;
+    const struct global_cfg *cfg;
+    struct drift_slot *slot;
+};
+
+static struct drift_ctl ctl;
+static const uint32_t *thread_cpus;
 static uint32_t thread_count;
 
-void drift_init(void)
+/*
+ * Sleep until the reference clock reaches 'deadline'. The reference clock
+ * might not be one the OS can sleep on, so the remaining time is measured
+ * on it and slept off against CLOCK_MONOTONIC, also as an absolute deadline.
+ */
+static void drift_sleep_until(const struct global_cfg *cfg, uint64_t deadline)
 {
-    #pragma omp parallel
+    uint64_t now;
+
+    clock_read(cfg->ref, &now);
+    if (now >= deadline)
+        return;
+
+#if defined(HAVE_CLOCK_GETTIME) && defined(CLOCK_MONOTONIC) && defined(TIMER_ABSTIME)
     {
-        #pragma omp master
-        {
-            thread_count = omp_get_num_threads();
-        }
+        struct timespec ts;
+        uint64_t until;
+
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        until = (ts.tv_sec * 1000000000ULL) + ts.tv_nsec + (deadline - now);
+        ts.tv_sec = until / 1000000000ULL;
+        ts.tv_nsec = until % 1000000000ULL;
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+            ;
     }
+#else
+    thread_sleep((deadline - now) / 1000);
+#endif
 }
 
-void drift_run(uint32_t runtime_ms, struct clockspec clkid, struct clockspec refid)
+static void drift_signal(uint32_t gen)
 {
-    uint32_t idx;
-    struct thread_ctx *threads = NULL;
-    struct global_cfg cfg;
-
-    memset(&cfg, 0, sizeof(struct global_cfg));
+    sync_store(&ctl.gen, gen);
+    sync_wake(&ctl.gen);
+}
 
-    cfg.clk = clkid;
-    cfg.ref = refid;
+/*
+ * Set the CPUs the drift tests run a thread on, one per CPU. The list has to
+ * outlive every drift_run().
+ */
+void drift_init(const uint32_t *cpus, uint32_t cpu_count)
+{
+    thread_cpus = cpus;
+    thread_count = cpu_count;
+}
 
-    threads = (struct thread_ctx *)calloc(thread_count, sizeof(struct thread_ctx));
+/*
+ * Read both clocks into a slot, either in nanoseconds or raw, with the
+ * reference read on both sides of the clock under test.
+ */
+static void drift_sample(const struct global_cfg *cfg, struct drift_slot *slot)
+{
+    if (cfg->ref_read_raw)
+        cfg->ref_read_raw(cfg->ref.minor, &slot->raw_ref, 1);
+    else
+        clock_read(cfg->ref, &slot->last_ref);
+    if (cfg->clk_read_raw)
+        cfg->clk_read_raw(cfg->clk.minor, &slot->raw_clk, 1);
+    else
+        clock_read(cfg->clk, &slot->last_clk);
+    if (cfg->ref_read_raw)
+        cfg->ref_read_raw(cfg->ref.minor, &slot->raw_ref_after, 1);
+    else
+        clock_read(cfg->ref, &slot->last_ref_after);
+}
 
-    /* Spawn drift thread per CPU */
-    #pragma omp parallel
-	{
-        int i;
+/*
+ * When a slot's clock reading was taken, as the midpoint of the reference
+ * readings around it, in ns since 'base' on the reference clock.
+ */
+static double drift_slot_when(const struct drift_slot *slot, uint64_t base)
+{
+    return (double)(int64_t)(slot->last_ref - base)
+        + (double)(slot->last_ref_after - slot->last_ref) / 2.0;
+}
 
-        #pragma omp master
-        {
-            struct thread_ctx *thread, *this = NULL;
-            uint64_t start_ref, start_clk;
-            int64_t delta_clk, expect_ms_ref;
+/*
+ * Convert the raw readings every thread reported for one clock in a single
+ * bulk conversion.
+ */
+static void drift_convert(struct clockspec spec, size_t raw_size, struct drift_slot *slots,
+                          size_t raw_offset, size_t ns_offset, unsigned char *raw, uint64_t *ns)
+{
+    uint32_t idx;
 
-            uint32_t unstarted;
+    for (idx = 0; idx < thread_count; idx++)
+        memcpy(raw + idx * raw_size, (unsigned char *)&slots[idx] + raw_offset, raw_size);
+    clock_raw_to_ns(spec, raw, ns, thread_count);
+    for (idx = 0; idx < thread_count; idx++)
+        memcpy((unsigned char *)&slots[idx] + ns_offset, &ns[idx], sizeof(uint64_t));
+}
 
-            do {
-                unstarted = 0;
-                for (idx = 0; idx < thread_count; idx++) {
-                    thread = &threads[idx];
-                    if (thread->state == UNSTARTED) {
-                        unstarted++;
-                        this = thread;
-                    }
-                }
-            } while (unstarted != 1);
+/*
+ * Print each CPU's fitted offset from the reference at the start of the
+ * run, its frequency error, and the jitter of its readings around the fit,
+ * all with 95% confidence intervals. The interval on the jitter uses the
+ * large-sample approximation sigma / sqrt(2 * dof).
+ */
+static void drift_summary(const struct linreg *fits)
+{
+    struct linreg_fit fit;
+    uint32_t idx;
+    double t;
+
+    printf("\n%4s %12s %9s %12s %9s %11s %9s %7s\n",
+           "CPU", "Offset(us)", "+/-", "Drift(ppm)", "+/-", "Jitter(ns)", "+/-", "Rounds");
+    for (idx = 0; idx < thread_count; idx++) {
+        if (linreg_solve(&fits[idx], &fit)) {
+            printf("%4" PRIu32 " (not enough rounds to fit)\n", thread_cpus[idx]);
+            continue;
+        }
+        t = stats_t_interval(95.0, fits[idx].n - 2);
+        printf("%4" PRIu32 " %12.3lf %9.3lf %12.4lf %9.4lf %11.1lf %9.1lf %7" PRIu64 "\n",
+               thread_cpus[idx],
+               fit.intercept / 1000.0, t * fit.intercept_stderr / 1000.0,
+               fit.slope * 1e6, t * fit.slope_stderr * 1e6,
+               fit.resid_stddev, t * fit.resid_stddev / sqrt(2.0 * (double)(fits[idx].n - 2)),
+               fits[idx].n);
+    }
+}
 
-            thread_bind(omp_get_thread_num());
+static void drift_worker(void *arg)
+{
+    struct drift_worker *worker = (struct drift_worker *)arg;
+    uint32_t gen = 0;
 
-            //uint64_t curr_clk;
-            //int64_t delta_ref, expect_ms_clk;
+    worker->bind_failed = thread_bind(worker->cpu);
+    sync_add(&ctl.bound, 1);
+    sync_wake(&ctl.bound);
 
-            clock_read(cfg.clk, &start_clk);
-            clock_read(cfg.ref, &start_ref);
+    for (;;) {
+        gen = sync_wait(&ctl.gen, gen, DRIFT_SPIN_LIMIT);
+        if (sync_load(&ctl.stop))
+            break;
 
-            do {
-                for (idx = 0; idx < thread_count; idx++) {
-                    thread = &threads[idx];
-                    if (thread->state > UNSTARTED)
-                        thread->state = REPORTING;
-                }
+        /* Woken up ahead of a round, so spin until it starts. */
+        if (gen & 1)
+            continue;
 
-                clock_read(cfg.clk, &this->last_clk);
-                clock_read(cfg.ref, &this->last_ref);
+        drift_sample(worker->cfg, worker->slot);
+        sync_store(&worker->slot->done, gen);
+    }
+}
 
-                for (idx = 0; idx < thread_count; idx++) {
-                    thread = &threads[idx];
-                    while (thread->state == REPORTING)
-                        thread_sleep(10);
-                }
+void drift_run(uint32_t runtime_ms, uint32_t interval_ms, uint32_t warmup_ms,
+               struct clockspec clkid, struct clockspec refid, int raw)
+{
+    uint32_t idx, started = 0, bound, gen = 0, rounds = 0;
+    struct drift_worker *workers = NULL;
+    struct drift_slot *slots;
+    struct linreg *fits = NULL;
+    struct linreg_fit fit;
+    struct global_cfg cfg;
+    unsigned char *raw_buf = NULL;
+    uint64_t *ns_buf = NULL;
+    void *slots_buf;
+    uint64_t start_ref = 0, start_clk = 0, spread, spread_min = UINT64_MAX, spread_max = 0;
+    uint64_t deadline, measure_start, end, now, missed = 0;
+    const uint64_t interval_ns = (uint64_t)interval_ms * 1000000ULL;
+    const uint64_t arm_ns = DRIFT_ARM_US * 1000ULL < interval_ns / 2
+                            ? DRIFT_ARM_US * 1000ULL : interval_ns / 2;
+    const uint32_t print_every = interval_ms < DRIFT_PRINT_MS
+                                 ? (DRIFT_PRINT_MS + interval_ms - 1) / interval_ms : 1;
+    int print;
+    double spread_sum = 0.0, start_when = 0.0;
+    int64_t expect_ms_ref;
+    double delta_clk;
 
-                expect_ms_ref = (this->last_ref / 1000000ULL) - (start_ref / 1000000ULL);
-                //expect_ms_clk = (this->last_clk / 1000000ULL) - (start_clk / 1000000ULL);
+    memset(&cfg, 0, sizeof(struct global_cfg));
 
-                printf("%9" PRId64 ": ", expect_ms_ref);
+    cfg.clk = clkid;
+    cfg.ref = refid;
+    if (raw) {
+        cfg.clk_raw_size = clock_raw_size(clkid);
+        cfg.ref_raw_size = clock_raw_size(refid);
+        if (cfg.clk_raw_size)
+            cfg.clk_read_raw = clock_find_raw_reader(clkid);
+        if (cfg.ref_raw_size)
+            cfg.ref_read_raw = clock_find_raw_reader(refid);
+        raw_buf = malloc(thread_count * sizeof(union clock_raw));
+        ns_buf = malloc(thread_count * sizeof(uint64_t));
+    }
 
-                for (idx = 0; idx < thread_count; idx++) {
-                    //int64_t ref_ms;
-                    int64_t clk_ms;
+    /* malloc() doesn't promise more than 16-byte alignment. */
+    slots_buf = calloc(thread_count + 1, sizeof(struct drift_slot));
+    slots = (struct drift_slot *)(((uintptr_t)slots_buf + DRIFT_SLOT_ALIGN - 1)
+                                  & ~(uintptr_t)(DRIFT_SLOT_ALIGN - 1));
+    workers = calloc(thread_count, sizeof(struct drift_worker));
+    fits = malloc(thread_count * sizeof(struct linreg));
+    if (!slots_buf || !workers || !fits || (raw && (!raw_buf || !ns_buf))) {
+        printf("error: out of memory\n");
+        goto cleanup;
+    }
 
-                    thread = &threads[idx];
+    sync_init(&ctl.gen, 0);
+    sync_init(&ctl.stop, 0);
+    sync_init(&ctl.bound, 0);
+    for (idx = 0; idx < thread_count; idx++) {
+        sync_init(&slots[idx].done, 0);
+        linreg_init(&fits[idx]);
+    }
 
-                    //ref_ms = (thread->last_ref / 1000000ULL) - (start_ref / 1000000ULL);
-                    clk_ms = (thread->last_clk / 1000000ULL) - (start_clk / 1000000ULL);
+    /* This thread takes the first CPU, and one thread is spawned per other CPU. */
+    if (thread_bind(thread_cpus[0])) {
+        printf("error: could not bind drift thread to CPU%" PRIu32 "\n", thread_cpus[0]);
+        goto cleanup;
+    }
+    for (idx = 1; idx < thread_count; idx++) {
+        workers[idx].cpu = thread_cpus[idx];
+        workers[idx].cfg = &cfg;
+        workers[idx].slot = &slots[idx];
+        if (thread_start(&workers[idx].thread, drift_worker, &workers[idx])) {
+            printf("error: failed to start drift thread for CPU%" PRIu32 "\n", thread_cpus[idx]);
+            goto stop;
+        }
+        started = idx;
+    }
 
-                    //delta_ref = (ref_ms - expect_ms_ref);
-                    delta_clk = (clk_ms - expect_ms_ref);
+    /* An unpinned thread would be reported as a CPU it may never have run on. */
+    while ((bound = sync_load(&ctl.bound)) < started)
+        sync_wait(&ctl.bound, bound, SYNC_SPIN_LIMIT);
+    for (idx = 1; idx <= started; idx++) {
+        if (workers[idx].bind_failed) {
+            printf("error: could not bind drift thread to CPU%" PRIu32 "\n", workers[idx].cpu);
+            goto stop;
+        }
+    }
 
-                    printf("%6" PRId64 ", ", delta_clk);
+    /*
+     * Measuring starts on the first deadline after the warm-up, so however
+     * the durations compare with the interval, at least one round is taken.
+     */
+    clock_read(cfg.ref, &deadline);
+    measure_start = deadline + (((uint64_t)warmup_ms + interval_ms - 1) / interval_ms)
+                               * interval_ns;
+    end = measure_start + (uint64_t)runtime_ms * 1000000ULL;
+
+    do {
+        drift_sleep_until(&cfg, deadline - arm_ns);
+        drift_signal(++gen);
+
+        drift_sleep_until(&cfg, deadline);
+        drift_signal(++gen);
+        drift_sample(&cfg, &slots[0]);
+
+        for (idx = 1; idx < thread_count; idx++) {
+            while (sync_load(&slots[idx].done) != gen)
+                cpu_relax();
+        }
 
-                    if ((idx + 1) % 8 == 0 && idx < thread_count - 1)
-                        printf("\n%11s", "");
-                }
+        if (cfg.clk_raw_size)
+            drift_convert(cfg.clk, cfg.clk_raw_size, slots,
+                          offsetof(struct drift_slot, raw_clk),
+                          offsetof(struct drift_slot, last_clk), raw_buf, ns_buf);
+        if (cfg.ref_raw_size) {
+            drift_convert(cfg.ref, cfg.ref_raw_size, slots,
+                          offsetof(struct drift_slot, raw_ref),
+                          offsetof(struct drift_slot, last_ref), raw_buf, ns_buf);
+            drift_convert(cfg.ref, cfg.ref_raw_size, slots,
+                          offsetof(struct drift_slot, raw_ref_after),
+                          offsetof(struct drift_slot, last_ref_after), raw_buf, ns_buf);
+        }
 
-                printf("\n");
+        /* Rounds during the warm-up are taken, but not reported. */
+        if (deadline >= measure_start) {
+            /*
+             * The first measured reading on the first CPU is the origin. It
+             * was taken halfway between its reference readings, not at the
+             * first of them, so that's where time on the reference starts.
+             */
+            if (!rounds) {
+                start_ref = slots[0].last_ref;
+                start_clk = slots[0].last_clk;
+                start_when = drift_slot_when(&slots[0], start_ref);
+            }
 
-                thread_sleep(1000000);
-            } while(expect_ms_ref < runtime_ms);
+            /* How far apart the threads took their readings this round. */
+            {
+                double lo = INFINITY, hi = -INFINITY, when;
 
-            for (idx = 0; idx < thread_count; idx++) {
-                thread = &threads[idx];
-                thread->state = EXITING;
+                for (idx = 0; idx < thread_count; idx++) {
+                    when = drift_slot_when(&slots[idx], start_ref);
+                    lo = fmin(lo, when);
+                    hi = fmax(hi, when);
+                }
+                spread = (uint64_t)(hi - lo);
+                spread_sum += (double)spread;
+                if (spread < spread_min)
+                    spread_min = spread;
+                if (spread > spread_max)
+                    spread_max = spread;
+                rounds++;
             }
-        }
 
-        #pragma omp for
-        for(i = 0; i < thread_count; i++)
-        {
-            uint32_t thread_id = omp_get_thread_num();
-            struct thread_ctx *ctx = &threads[thread_id];
+            print = (rounds - 1) % print_every == 0;
+            expect_ms_ref = (int64_t)((drift_slot_when(&slots[0], start_ref) - start_when) / 1e6);
 
-            struct clockspec clk_id = cfg.clk;
-            struct clockspec ref_id = cfg.ref;
+            if (print)
+                printf("%9" PRId64 " (skew %8.3lf): ", expect_ms_ref, spread / 1000.0);
 
-            thread_bind(thread_id);
+            /*
+             * Each clock reading is compared to when the reference says that
+             * thread took it, not to when the master did, so the skew between
+             * threads doesn't show up as drift. What's left is uncertain by half
+             * the time between the reference readings around it.
+             */
+            for (idx = 0; idx < thread_count; idx++) {
+                const struct drift_slot *slot = &slots[idx];
+                double when = drift_slot_when(slot, start_ref) - start_when;
 
-            //printf("starting thread %d : %d\n", thread_id, i);
-            if (ctx->state != UNSTARTED)
-                continue;
+                delta_clk = (double)(int64_t)(slot->last_clk - start_clk) - when;
+                linreg_add(&fits[idx], when, delta_clk);
+                if (!print)
+                    continue;
 
-            do {
-                uint64_t clk;
-                uint64_t ref;
-                while (ctx->state == WAITING) {
-                    //printf("thread %d:%d waiting\n", thread_id, i);
-                    thread_sleep(100);
-                }
+                printf("%10.3lf +/- %-7.3lf ", delta_clk / 1000.0,
+                       (double)(slot->last_ref_after - slot->last_ref) / 2000.0);
 
-                if (ctx->state == EXITING)
-                    break;
+                if ((idx + 1) % 4 == 0 && idx < thread_count - 1)
+                    printf("\n%27s", "");
+            }
 
-                clock_read(clk_id, &clk);
-                clock_read(ref_id, &ref);
+            if (print)
+                printf("\n");
 
-                ctx->last_clk = clk;
-                ctx->last_ref = ref;
-                ctx->state = WAITING;
-            } while(1);
+            /*
+             * The slope of each CPU's drift against the reference is its
+             * frequency error. Show it as it firms up. Every CPU has had the
+             * same number of rounds, so they share one t quantile.
+             */
+            if (print && fits[0].n >= 3) {
+                double t = stats_t_interval(95.0, fits[0].n - 2);
 
-            ctx->state = DEAD;
+                printf("%25s: ", "ppm");
+                for (idx = 0; idx < thread_count; idx++) {
+                    if (linreg_solve(&fits[idx], &fit))
+                        printf("%10s     %-7s ", "----", "");
+                    else
+                        printf("%10.3lf +/- %-7.3lf ", fit.slope * 1e6,
+                               t * fit.slope_stderr * 1e6);
+
+                    if ((idx + 1) % 4 == 0 && idx < thread_count - 1)
+                        printf("\n%27s", "");
+                }
+                printf("\n");
+            }
         }
-    }
 
-    free(threads);
+        /*
+         * Deadlines are absolute, so the time a round takes doesn't push
+         * the next one back. Ones we're already past are skipped.
+         */
+        deadline += interval_ns;
+        clock_read(cfg.ref, &now);
+        while (deadline < now) {
+            deadline += interval_ns;
+            missed++;
+        }
+    } while (deadline <= end);
+
+    if (rounds)
+        printf("%9s: min %.3lf, mean %.3lf, max %.3lf us\n", "Spread",
+               spread_min / 1000.0, spread_sum / rounds / 1000.0, spread_max / 1000.0);
+    if (missed)
+        printf("%9s: %" PRIu64 " rounds skipped, the previous one ran past them\n",
+               "Missed", missed);
+
+    drift_summary(fits);
+
+stop:
+    sync_store(&ctl.stop, 1);
+    drift_signal(++gen);
+    for (idx = 1; idx <= started; idx++)
+        thread_join(&workers[idx].thread);
+
+cleanup:
+    free(workers);
+    free(fits);
+    free(slots_buf);
+    free(raw_buf);
+    free(ns_buf);
 }
 
 #endif
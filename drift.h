@@ -21,10 +21,12 @@
 
 #include "platform.h"
 #include "clock.h"
+#include "sync.h"
 
-#ifdef _OPENMP
+#ifdef HAVE_SYNC
 #define HAVE_DRIFT_TESTS
 #endif
 
-void drift_init(void);
-void drift_run(uint32_t runtime_ms, struct clockspec clkid, struct clockspec refid);
+void drift_init(const uint32_t *cpus, uint32_t cpu_count);
+void drift_run(uint32_t runtime_ms, uint32_t interval_ms, uint32_t warmup_ms,
+               struct clockspec clkid, struct clockspec refid, int raw);
@@ -0,0 +1,156 @@
+/*
+ * clockperf
+ *
+ * Copyright (c) 2016-2021, Steven Noonan <steven@uplinklabs.net>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ */
+
+#include "prefix.h"
+#include "hist.h"
+
+#ifdef TARGET_COMPILER_MSVC
+#include <intrin.h>
+#endif
+
+static INLINE uint32_t hist_msb(uint64_t v)
+{
+#if defined(TARGET_COMPILER_GCC)
+    return 63 - __builtin_clzll(v);
+#elif defined(TARGET_COMPILER_MSVC) && defined(_M_X64)
+    unsigned long idx;
+    _BitScanReverse64(&idx, v);
+    return idx;
+#else
+    uint32_t msb = 0;
+    while (v >>= 1)
+        msb++;
+    return msb;
+#endif
+}
+
+static INLINE uint32_t hist_index(uint64_t v)
+{
+    uint32_t shift;
+
+    if (v < HIST_SUB_COUNT)
+        return (uint32_t)v;
+    shift = hist_msb(v) - (HIST_SUB_BITS - 1);
+    return HIST_SUB_COUNT + (shift - 1) * (HIST_SUB_COUNT / 2)
+         + (uint32_t)(v >> shift) - HIST_SUB_COUNT / 2;
+}
+
+/*
+ * The smallest value that lands in a bucket, and the bucket's width.
+ */
+static void hist_bucket(uint32_t idx, uint64_t *lo, uint64_t *width)
+{
+    uint32_t shift;
+
+    if (idx < HIST_SUB_COUNT) {
+        *lo = idx;
+        *width = 1;
+        return;
+    }
+    idx -= HIST_SUB_COUNT;
+    shift = idx / (HIST_SUB_COUNT / 2) + 1;
+    *lo = (uint64_t)(idx % (HIST_SUB_COUNT / 2) + HIST_SUB_COUNT / 2) << shift;
+    *width = 1ULL << shift;
+}
+
+void hist_init(struct hist *h)
+{
+    memset(h, 0, sizeof(*h));
+    h->min = UINT64_MAX;
+}
+
+void hist_record(struct hist *h, uint64_t value)
+{
+    h->counts[hist_index(value)]++;
+    h->count++;
+    if (value < h->min)
+        h->min = value;
+    if (value > h->max)
+        h->max = value;
+}
+
+/*
+ * Add every value recorded in 'src' to 'dst'.
+ */
+void hist_merge(struct hist *dst, const struct hist *src)
+{
+    uint32_t i;
+
+    for (i = 0; i < HIST_BUCKETS; i++)
+        dst->counts[i] += src->counts[i];
+    dst->count += src->count;
+    if (src->min < dst->min)
+        dst->min = src->min;
+    if (src->max > dst->max)
+        dst->max = src->max;
+}
+
+/*
+ * The value below which 'percentile' percent of the recorded values fall,
+ * reported as the top of the bucket it lands in (but never past the largest
+ * value actually recorded).
+ */
+uint64_t hist_percentile(const struct hist *h, double percentile)
+{
+    uint64_t target, seen = 0, lo, width;
+    uint32_t i;
+
+    if (!h->count)
+        return 0;
+
+    target = (uint64_t)ceil(percentile / 100.0 * (double)h->count);
+    if (target < 1)
+        target = 1;
+    if (target >= h->count)
+        return h->max;
+
+    for (i = 0; i < HIST_BUCKETS; i++) {
+        seen += h->counts[i];
+        if (seen >= target) {
+            hist_bucket(i, &lo, &width);
+            if (lo + width - 1 > h->max)
+                return h->max;
+            return lo + width - 1;
+        }
+    }
+    return h->max;
+}
+
+/*
+ * Print every non-empty bucket with its count and the cumulative share of
+ * values up to and including it.
+ */
+void hist_dump(const struct hist *h, FILE *out)
+{
+    uint64_t seen = 0, lo, width;
+    uint32_t i;
+
+    fprintf(out, "%20s %20s %12s %9s\n", "From", "To", "Count", "Cumul");
+    for (i = 0; i < HIST_BUCKETS; i++) {
+        if (!h->counts[i])
+            continue;
+        seen += h->counts[i];
+        hist_bucket(i, &lo, &width);
+        fprintf(out, "%20" PRIu64 " %20" PRIu64 " %12" PRIu64 " %8.4lf%%\n",
+                lo, lo + width - 1, h->counts[i],
+                100.0 * (double)seen / (double)h->count);
+    }
+}
+
+/* vim: set ts=4 sts=4 sw=4 et: */
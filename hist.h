@@ -0,0 +1,50 @@
+/*
+ * clockperf
+ *
+ * Copyright (c) 2016-2021, Steven Noonan <steven@uplinklabs.net>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ */
+
+#pragma once
+
+#include "platform.h"
+
+#include <stdio.h>
+
+/*
+ * Log-linear (HDR-style) histogram of nonnegative integer values. Values
+ * below HIST_SUB_COUNT get a bucket each; above that, every power of two is
+ * split into HIST_SUB_COUNT / 2 equal buckets, so a value is only ever
+ * rounded by less than 2 / HIST_SUB_COUNT of itself, across the full 64-bit
+ * range.
+ */
+#define HIST_SUB_BITS 7
+#define HIST_SUB_COUNT (1U << HIST_SUB_BITS)
+#define HIST_BUCKETS (HIST_SUB_COUNT + (64 - HIST_SUB_BITS) * (HIST_SUB_COUNT / 2))
+
+struct hist {
+    uint64_t count;
+    uint64_t min;
+    uint64_t max;
+    uint64_t counts[HIST_BUCKETS];
+};
+
+void hist_init(struct hist *h);
+void hist_record(struct hist *h, uint64_t value);
+void hist_merge(struct hist *dst, const struct hist *src);
+uint64_t hist_percentile(const struct hist *h, double percentile);
+void hist_dump(const struct hist *h, FILE *out);
+
+/* vim: set ts=4 sts=4 sw=4 et: */
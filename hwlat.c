@@ -0,0 +1,229 @@
+/*
+ * clockperf
+ *
+ * Copyright (c) 2016-2021, Steven Noonan <steven@uplinklabs.net>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ */
+
+#include "prefix.h"
+#include "affinity.h"
+#include "clock.h"
+#include "hist.h"
+#include "hwlat.h"
+#include "stats.h"
+
+/*
+ * Gaps kept per CPU for the periodicity analysis and the list of the
+ * largest ones. Gaps past this are still counted.
+ */
+#define HWLAT_MAX_EVENTS    65536
+
+/*
+ * Number of largest gaps listed per CPU.
+ */
+#define HWLAT_TOP_EVENTS    5
+
+/*
+ * Readings taken back to back before they're checked for gaps.
+ */
+#define HWLAT_BATCH         256
+
+struct hwlat_event {
+    uint64_t when;      /* ns since the start of the run on this CPU */
+    uint64_t gap;
+};
+
+struct hwlat_cpu {
+    uint64_t reads;
+    uint64_t gaps;
+    uint64_t total;
+    uint64_t regressions;
+    uint64_t elapsed;
+    uint32_t event_count;
+    struct hwlat_event *events;
+    struct hist durations;
+};
+
+/*
+ * Spin on the clock for 'runtime_ns', recording every gap between
+ * consecutive readings longer than 'threshold_ns'. Nothing else runs in the
+ * loop, so a gap is time the CPU was taken away from us: an interrupt, an
+ * SMI, a hypervisor exit, or preemption.
+ *
+ * The readings are taken in batches with clock_read_n(), so the gaps inside
+ * a batch are the clock alone, without clock_read()'s dispatch. Only the gap
+ * across the check between batches also holds HWLAT_BATCH comparisons. A
+ * clock without a specialized loop falls back to clock_read().
+ */
+static void hwlat_spin(struct clockspec clk, uint64_t runtime_ns, uint64_t threshold_ns,
+                       struct hwlat_cpu *ctx)
+{
+    uint64_t batch[HWLAT_BATCH], start, last, now = 0;
+    int direct = clock_read_n(clk, batch, 1) == 0;
+    uint32_t i;
+
+    clock_read(clk, &start);
+    last = start;
+    do {
+        if (direct) {
+            clock_read_n(clk, batch, HWLAT_BATCH);
+        } else {
+            for (i = 0; i < HWLAT_BATCH; i++)
+                clock_read(clk, &batch[i]);
+        }
+        ctx->reads += HWLAT_BATCH;
+
+        for (i = 0; i < HWLAT_BATCH; i++) {
+            now = batch[i];
+            if (now < last) {
+                ctx->regressions++;
+            } else if (now - last > threshold_ns) {
+                uint64_t gap = now - last;
+
+                ctx->gaps++;
+                ctx->total += gap;
+                hist_record(&ctx->durations, gap);
+                if (ctx->event_count < HWLAT_MAX_EVENTS) {
+                    ctx->events[ctx->event_count].when = last - start;
+                    ctx->events[ctx->event_count].gap = gap;
+                    ctx->event_count++;
+                }
+            }
+            last = now;
+        }
+    } while (now - start < runtime_ns);
+
+    ctx->elapsed = now - start;
+}
+
+/*
+ * Median time between the starts of consecutive gaps, in nanoseconds, and
+ * the share of intervals within 10% of it. A periodic source like the
+ * scheduler tick shows up as a median matching its period with most
+ * intervals close to it.
+ */
+static double hwlat_period(const struct hwlat_cpu *ctx, double *regular)
+{
+    double *intervals, median;
+    uint32_t i, n, close = 0;
+
+    *regular = 0.0;
+    if (ctx->event_count < 3)
+        return 0.0;
+
+    n = ctx->event_count - 1;
+    intervals = malloc(sizeof(double) * n);
+    if (!intervals)
+        return 0.0;
+    for (i = 0; i < n; i++)
+        intervals[i] = (double)(ctx->events[i + 1].when - ctx->events[i].when);
+
+    median = stats_median(intervals, n);
+    for (i = 0; i < n; i++) {
+        if (fabs(intervals[i] - median) <= median * 0.1)
+            close++;
+    }
+    *regular = 100.0 * close / n;
+
+    free(intervals);
+    return median;
+}
+
+static int compare_event_gap(const void *pa, const void *pb)
+{
+    const struct hwlat_event *a = pa, *b = pb;
+
+    if (a->gap > b->gap)
+        return -1;
+    if (a->gap < b->gap)
+        return 1;
+    return 0;
+}
+
+/*
+ * Spin on each of the given CPUs in turn and report the gaps seen on each.
+ *
+ * Returns zero on success, nonzero on failure.
+ */
+int hwlat_run(struct clockspec clkid, uint32_t runtime_ms, uint64_t threshold_ns,
+              const uint32_t *cpus, uint32_t cpu_count)
+{
+    struct hwlat_cpu *results;
+    uint32_t idx, i;
+    int ret = 1;
+
+    results = calloc(cpu_count, sizeof(struct hwlat_cpu));
+    if (!results)
+        return 1;
+
+    for (idx = 0; idx < cpu_count; idx++) {
+        results[idx].events = malloc(sizeof(struct hwlat_event) * HWLAT_MAX_EVENTS);
+        if (!results[idx].events)
+            goto cleanup;
+        hist_init(&results[idx].durations);
+    }
+
+    printf("%4s %12s %8s %10s %7s %9s %9s %10s %11s %8s\n",
+           "CPU", "Reads", "Gaps", "Total(us)", "Lost%", "p50(ns)", "p99(ns)", "max(ns)",
+           "Period(ms)", "Regular");
+
+    for (idx = 0; idx < cpu_count; idx++) {
+        struct hwlat_cpu *ctx = &results[idx];
+        double period, regular;
+
+        if (thread_bind(cpus[idx])) {
+            printf("%4" PRIu32 " (could not bind, skipping)\n", cpus[idx]);
+            continue;
+        }
+
+        hwlat_spin(clkid, (uint64_t)runtime_ms * 1000000ULL, threshold_ns, ctx);
+        period = hwlat_period(ctx, &regular);
+
+        printf("%4" PRIu32 " %12" PRIu64 " %8" PRIu64 " %10.1lf %6.3lf%% %9" PRIu64 " %9" PRIu64 " %10" PRIu64,
+               cpus[idx], ctx->reads, ctx->gaps, ctx->total / 1000.0,
+               100.0 * (double)ctx->total / (double)ctx->elapsed,
+               hist_percentile(&ctx->durations, 50.0),
+               hist_percentile(&ctx->durations, 99.0),
+               ctx->gaps ? ctx->durations.max : 0);
+        if (period > 0.0)
+            printf(" %11.3lf %7.1lf%%\n", period / 1e6, regular);
+        else
+            printf(" %11s %8s\n", "----", "----");
+        if (ctx->regressions)
+            printf("%4s clock went backwards %" PRIu64 " times\n", "", ctx->regressions);
+    }
+
+    printf("\nLargest gaps:\n\n");
+    printf("%4s %12s %10s\n", "CPU", "At(ms)", "Gap(ns)");
+    for (idx = 0; idx < cpu_count; idx++) {
+        struct hwlat_cpu *ctx = &results[idx];
+
+        qsort(ctx->events, ctx->event_count, sizeof(struct hwlat_event), compare_event_gap);
+        for (i = 0; i < ctx->event_count && i < HWLAT_TOP_EVENTS; i++) {
+            printf("%4" PRIu32 " %12.3lf %10" PRIu64 "\n",
+                   cpus[idx], ctx->events[i].when / 1e6, ctx->events[i].gap);
+        }
+    }
+
+    ret = 0;
+
+cleanup:
+    for (idx = 0; idx < cpu_count; idx++)
+        free(results[idx].events);
+    free(results);
+    return ret;
+}
+
+/* vim: set ts=4 sts=4 sw=4 et: */
@@ -20,8 +20,17 @@
 #include "prefix.h"
 #include "affinity.h"
 #include "clock.h"
+#include "clocksource.h"
+#include "convert.h"
 #include "drift.h"
+#include "hist.h"
+#include "hwlat.h"
+#include "perf.h"
+#include "pingpong.h"
+#include "scale.h"
+#include "stats.h"
 #include "util.h"
+#include "vdso.h"
 #include "version.h"
 
 #ifdef _MSC_VER
@@ -30,19 +39,33 @@
 #endif
 
 #include <getopt.h>
+#include <signal.h>
+
+/*
+ * Room for the clocksources below plus any discovered at runtime (e.g.
+ * dynamic POSIX clocks). Unused entries are zeroed, i.e. CPERF_NULL.
+ */
+#define MAX_CLOCK_SOURCES 128
 
 /*
  * We run tests in pairs of clocks, attempting to corroborate the first clock
  * with the results of the second clock. If there's too much mismatch between
  * the two, then a warning is printed.
  */
-static struct clockspec clock_sources[] = {
-    /* Characterizes overhead of measurement mechanism. */
-    //{CPERF_NONE, 0},
-
+static struct clockspec clock_sources[MAX_CLOCK_SOURCES] = {
 #ifdef HAVE_CPU_CLOCK
     {CPERF_TSC, 0},
 #endif
+#if defined(HAVE_CPU_CLOCK) && defined(HAVE_PERF_TIMEBASE)
+    {CPERF_PERF_TSC, 0},
+#endif
+#ifdef HAVE_CPU_CLOCK_ORDERED
+    {CPERF_RDTSCP, 0},
+    {CPERF_LFENCE_RDTSC, 0},
+    {CPERF_RDTSC_LFENCE, 0},
+    {CPERF_MFENCE_RDTSC, 0},
+    {CPERF_RDPRU, 0},
+#endif
 #ifdef HAVE_GETTIMEOFDAY
     {CPERF_GTOD, 0},
 #endif
@@ -69,6 +92,15 @@ static struct clockspec clock_sources[] = {
 #ifdef CLOCK_BOOTTIME
     {CPERF_GETTIME, CLOCK_BOOTTIME},
 #endif
+#ifdef CLOCK_TAI
+    {CPERF_GETTIME, CLOCK_TAI},
+#endif
+#ifdef CLOCK_REALTIME_ALARM
+    {CPERF_GETTIME, CLOCK_REALTIME_ALARM},
+#endif
+#ifdef CLOCK_BOOTTIME_ALARM
+    {CPERF_GETTIME, CLOCK_BOOTTIME_ALARM},
+#endif
 #ifdef CLOCK_UPTIME_RAW // OS X
     {CPERF_GETTIME, CLOCK_UPTIME_RAW},
 #endif
@@ -82,6 +114,92 @@ static struct clockspec clock_sources[] = {
     {CPERF_GETTIME, CLOCK_THREAD_CPUTIME_ID},
 #endif
 #endif
+#ifdef HAVE_VDSO
+    {CPERF_VDSO_GTOD, 0},
+    {CPERF_VDSO_GETTIME, CLOCK_REALTIME},
+#ifdef CLOCK_REALTIME_COARSE
+    {CPERF_VDSO_GETTIME, CLOCK_REALTIME_COARSE},
+#endif
+#ifdef CLOCK_MONOTONIC
+    {CPERF_VDSO_GETTIME, CLOCK_MONOTONIC},
+#endif
+#ifdef CLOCK_MONOTONIC_COARSE
+    {CPERF_VDSO_GETTIME, CLOCK_MONOTONIC_COARSE},
+#endif
+#ifdef CLOCK_MONOTONIC_RAW
+    {CPERF_VDSO_GETTIME, CLOCK_MONOTONIC_RAW},
+#endif
+#ifdef CLOCK_MONOTONIC_RAW_APPROX // OS X
+    {CPERF_VDSO_GETTIME, CLOCK_MONOTONIC_RAW_APPROX},
+#endif
+#ifdef CLOCK_BOOTTIME
+    {CPERF_VDSO_GETTIME, CLOCK_BOOTTIME},
+#endif
+#ifdef CLOCK_TAI
+    {CPERF_VDSO_GETTIME, CLOCK_TAI},
+#endif
+#ifdef CLOCK_REALTIME_ALARM
+    {CPERF_VDSO_GETTIME, CLOCK_REALTIME_ALARM},
+#endif
+#ifdef CLOCK_BOOTTIME_ALARM
+    {CPERF_VDSO_GETTIME, CLOCK_BOOTTIME_ALARM},
+#endif
+#ifdef CLOCK_UPTIME_RAW // OS X
+    {CPERF_VDSO_GETTIME, CLOCK_UPTIME_RAW},
+#endif
+#ifdef CLOCK_UPTIME_RAW_APPROX // OS X
+    {CPERF_VDSO_GETTIME, CLOCK_UPTIME_RAW_APPROX},
+#endif
+#ifdef CLOCK_PROCESS_CPUTIME_ID
+    {CPERF_VDSO_GETTIME, CLOCK_PROCESS_CPUTIME_ID},
+#endif
+#ifdef CLOCK_THREAD_CPUTIME_ID
+    {CPERF_VDSO_GETTIME, CLOCK_THREAD_CPUTIME_ID},
+#endif
+    {CPERF_VDSO_TIME, 0},
+#endif
+#ifdef HAVE_SYSCALL_GETTIME
+    {CPERF_SYSCALL_GETTIME, CLOCK_REALTIME},
+#ifdef CLOCK_REALTIME_COARSE
+    {CPERF_SYSCALL_GETTIME, CLOCK_REALTIME_COARSE},
+#endif
+#ifdef CLOCK_MONOTONIC
+    {CPERF_SYSCALL_GETTIME, CLOCK_MONOTONIC},
+#endif
+#ifdef CLOCK_MONOTONIC_COARSE
+    {CPERF_SYSCALL_GETTIME, CLOCK_MONOTONIC_COARSE},
+#endif
+#ifdef CLOCK_MONOTONIC_RAW
+    {CPERF_SYSCALL_GETTIME, CLOCK_MONOTONIC_RAW},
+#endif
+#ifdef CLOCK_MONOTONIC_RAW_APPROX // OS X
+    {CPERF_SYSCALL_GETTIME, CLOCK_MONOTONIC_RAW_APPROX},
+#endif
+#ifdef CLOCK_BOOTTIME
+    {CPERF_SYSCALL_GETTIME, CLOCK_BOOTTIME},
+#endif
+#ifdef CLOCK_TAI
+    {CPERF_SYSCALL_GETTIME, CLOCK_TAI},
+#endif
+#ifdef CLOCK_REALTIME_ALARM
+    {CPERF_SYSCALL_GETTIME, CLOCK_REALTIME_ALARM},
+#endif
+#ifdef CLOCK_BOOTTIME_ALARM
+    {CPERF_SYSCALL_GETTIME, CLOCK_BOOTTIME_ALARM},
+#endif
+#ifdef CLOCK_UPTIME_RAW // OS X
+    {CPERF_SYSCALL_GETTIME, CLOCK_UPTIME_RAW},
+#endif
+#ifdef CLOCK_UPTIME_RAW_APPROX // OS X
+    {CPERF_SYSCALL_GETTIME, CLOCK_UPTIME_RAW_APPROX},
+#endif
+#ifdef CLOCK_PROCESS_CPUTIME_ID
+    {CPERF_SYSCALL_GETTIME, CLOCK_PROCESS_CPUTIME_ID},
+#endif
+#ifdef CLOCK_THREAD_CPUTIME_ID
+    {CPERF_SYSCALL_GETTIME, CLOCK_THREAD_CPUTIME_ID},
+#endif
+#endif
 #ifdef HAVE_CLOCK
     {CPERF_CLOCK, 0},
 #endif
@@ -108,75 +226,73 @@ static struct clockspec clock_sources[] = {
     {CPERF_NULL, 0},
 };
 
-static int compare_double(const void *pa, const void *pb)
+#ifdef HAVE_DYNAMIC_CLOCKS
+static void add_dynamic_clocks(void)
 {
-    double a = *(double *)pa,
-           b = *(double *)pb;
+    size_t n = 0;
 
-    if (a < b)
-        return -1;
-    if (a > b)
-        return 1;
-    return 0;
+    while (clock_sources[n].major != CPERF_NULL)
+        n++;
+
+    /* Keep the last entry as a terminator. */
+    clock_open_dynamic(&clock_sources[n], MAX_CLOCK_SOURCES - n - 1);
 }
+#endif
+
+/*
+ * Confidence level, in percent, of the error bounds in the behavior tests.
+ */
+static double confidence = 95.0;
+
+/*
+ * Number of timed samples per clock in the behavior tests, or 0 to pick one
+ * from the clock's resolution.
+ */
+static uint32_t sample_count;
+
+/*
+ * Adaptive sampling: when 'precision' is set, keep taking samples of each
+ * clock until the confidence interval of its cost is within that many
+ * percent of the mean, or until 'budget_ms' of sampling has passed.
+ */
+static double precision;
+static uint32_t budget_ms = 2000;
+
+/*
+ * Cost of the measurement harness per reading, in nanoseconds, with the
+ * half-width of its confidence interval. This is the loop in clock_compare()
+ * plus the dispatch in clock_read(), and applies to the cost measured through
+ * clock_read(). It's measured by running clock_compare() on the null clock,
+ * which reads nothing.
+ */
+static double overhead, overhead_error;
 
-static void calc_error(double *times, uint32_t samples, double *mean, double *error)
+/*
+ * The specialized loops only pay for the reference clock reads around each
+ * sample, spread over the reads in it. That depends on which reference a
+ * clock is measured against, so it's measured once for each one, by
+ * bracket_overhead().
+ */
+#define MAX_BRACKETS        8
+#define BRACKET_SAMPLES     1000
+
+static struct {
+    struct clockspec ref;
+    double cost;
+} brackets[MAX_BRACKETS];
+static uint32_t bracket_count;
+
+#define ADAPTIVE_MIN_SAMPLES    30
+#define ADAPTIVE_MAX_SAMPLES    (1U << 20)
+
+static void calc_error(double *times, uint32_t samples, double *mean, double *error,
+                       double *median)
 {
     double T;
     double sum, variance, deviation, sem;
     size_t i;
 
-    switch (samples-1) {
-        case 1:   T = 12.71; break;
-        case 2:   T = 4.303; break;
-        case 3:   T = 3.182; break;
-        case 4:   T = 2.776; break;
-        case 5:   T = 2.571; break;
-        case 6:   T = 2.447; break;
-        case 7:   T = 2.365; break;
-        case 8:   T = 2.306; break;
-        case 9:   T = 2.262; break;
-        case 10:  T = 2.228; break;
-        case 11:  T = 2.201; break;
-        case 12:  T = 2.179; break;
-        case 13:  T = 2.160; break;
-        case 14:  T = 2.145; break;
-        case 15:  T = 2.131; break;
-        case 16:  T = 2.120; break;
-        case 17:  T = 2.110; break;
-        case 18:  T = 2.101; break;
-        case 19:  T = 2.093; break;
-        case 20:  T = 2.086; break;
-        case 21:  T = 2.080; break;
-        case 22:  T = 2.074; break;
-        case 23:  T = 2.069; break;
-        case 24:  T = 2.064; break;
-        case 25:  T = 2.060; break;
-        case 26:  T = 2.056; break;
-        case 27:  T = 2.052; break;
-        case 28:  T = 2.048; break;
-        case 29:  T = 2.045; break;
-        case 30:  T = 2.042; break;
-        case 190:
-        case 191:
-        case 192:
-        case 193:
-        case 194:
-        case 195:
-        case 196:
-        case 197:
-        case 198:
-        case 199:
-        case 200:
-            T = 1.960;
-            break;
-        default:
-            printf("Don't know how to deal with statistics for %u samples\n", samples);
-            abort();
-            break;
-    }
-
-    qsort(times, samples, sizeof(double), compare_double);
+    T = stats_t_interval(confidence, samples - 1);
 
     sum = 0.0;
     for (i = 0; i < samples; i++) {
@@ -195,6 +311,23 @@ static void calc_error(double *times, uint32_t samples, double *mean, double *er
     sem = T * (deviation / sqrt((double)samples));
 
     *error = sem / *mean * 100.0;
+
+    /* Reorders the samples, so this has to come last. */
+    if (median)
+        *median = stats_median(times, samples);
+}
+
+/*
+ * Subtract the harness overhead from a cost and its error as returned by
+ * calc_error(), combining the two errors in quadrature.
+ */
+static void subtract_overhead(double *mean, double *error)
+{
+    double abs_error = *mean * (*error / 100.0);
+
+    *mean -= overhead;
+    abs_error = sqrt(abs_error * abs_error + overhead_error * overhead_error);
+    *error = *mean != 0.0 ? abs_error / fabs(*mean) * 100.0 : INFINITY;
 }
 
 static int range_intersects(double m1, double e1, double m2, double e2)
@@ -206,6 +339,7 @@ static int range_intersects(double m1, double e1, double m2, double e2)
 }
 
 const char *rate_suffixes[] = { "Hz", "KHz", "MHz", "GHz", NULL };
+const char *read_rate_suffixes[] = { "/s", "K/s", "M/s", "G/s", NULL };
 
 static const char *pretty_print(char *buffer, size_t bufsz, double v,
                                 const char **suffixes, uint32_t bar)
@@ -224,26 +358,164 @@ static const char *pretty_print(char *buffer, size_t bufsz, double v,
 }
 
 
-const uint32_t ITERS = 1000;
+#define ITERS_MAX 1000
+const uint32_t ITERS = ITERS_MAX;
+
+/*
+ * Capture raw clock values (CPU clock ticks, struct timespec) in the timed
+ * loops and convert them to nanoseconds in bulk afterward, where the clock
+ * supports it.
+ */
+static int do_raw;
+
+/*
+ * Dump the full read-to-read interval histogram of every clock.
+ */
+static int do_histogram;
+
+/*
+ * Target duration and bounds for the back-to-back capture in clock_compare().
+ */
+#define CAPTURE_NSEC        50000000.0
+#define CAPTURE_MIN_READS   (1U << 16)
+#define CAPTURE_MAX_READS   (1U << 22)
+
+/*
+ * Capture a long run of consecutive readings from a clock and look at the
+ * gaps between them. With millions of back-to-back readings we get a much
+ * better estimate of the clock's resolution than from the handful of ticks
+ * we wait for in clock_compare(), and we can spot regressions that happen
+ * too rarely to show up there.
+ *
+ * 'cost' is the approximate cost of a read in nanoseconds, used to size the
+ * capture. Updates 'observed_res' (0 if every reading was distinct) and
+ * returns the number of times the clock went backwards. Every forward gap
+ * between consecutive readings is recorded in 'intervals'.
+ */
+static uint32_t capture_gaps(const struct clockspec self, double cost, uint64_t *observed_res,
+                             struct hist *intervals)
+{
+    uint64_t *capture, capture_res = (uint64_t)-1;
+    uint32_t regressions = 0;
+    size_t i, n, raw_size, repeats = 0;
+
+    n = (size_t)(CAPTURE_NSEC / fmax(cost, 1.0));
+    if (n < CAPTURE_MIN_READS)
+        n = CAPTURE_MIN_READS;
+    if (n > CAPTURE_MAX_READS)
+        n = CAPTURE_MAX_READS;
+
+    capture = malloc(sizeof(uint64_t) * n);
+    if (!capture)
+        return 0;
+
+    raw_size = do_raw ? clock_raw_size(self) : 0;
+    if (raw_size) {
+        void *raw = malloc(raw_size * n);
+
+        if (!raw)
+            goto cleanup;
+        clock_read_raw_n(self, raw, n);
+        clock_raw_to_ns(self, raw, capture, n);
+        free(raw);
+    } else if (clock_read_n(self, capture, n) != 0) {
+        goto cleanup;
+    }
+
+    for (i = 1; i < n; i++) {
+        int64_t gap = (int64_t)(capture[i] - capture[i - 1]);
+        if (gap < 0) {
+            regressions++;
+            continue;
+        }
+        if (intervals)
+            hist_record(intervals, (uint64_t)gap);
+        if (gap == 0)
+            repeats++;
+        else if ((uint64_t)gap < capture_res)
+            capture_res = gap;
+    }
+
+    if (!repeats) {
+        /* Distinct value on every read, can't infer resolution. */
+        *observed_res = 0;
+    } else if (capture_res != (uint64_t)-1) {
+        *observed_res = capture_res;
+    }
+
+cleanup:
+    free(capture);
+    return regressions;
+}
+
+/*
+ * Events per sample for the Fail, Warp, Stal and Regr columns, rounded up,
+ * so that a clock with any at all never shows zero next to Mono=No.
+ */
+static uint32_t per_sample(uint32_t events, uint32_t samples)
+{
+    return (events + samples - 1) / samples;
+}
+
+/*
+ * Cost of the reads of 'ref' around a sample of a specialized loop, per
+ * read in the sample, in nanoseconds. Two back-to-back reference reads are
+ * one bracket.
+ */
+static double bracket_overhead(const struct clockspec ref)
+{
+    static double cost[BRACKET_SAMPLES];
+    double mean, error;
+    uint64_t o[2];
+    uint32_t i;
+
+    for (i = 0; i < bracket_count; i++) {
+        if (brackets[i].ref.major == ref.major && brackets[i].ref.minor == ref.minor)
+            return brackets[i].cost;
+    }
+
+    for (i = 0; i < BRACKET_SAMPLES; i++) {
+        clock_read(ref, &o[0]);
+        clock_read(ref, &o[1]);
+        cost[i] = (double)(o[1] - o[0]) / (double)ITERS;
+    }
+    calc_error(cost, BRACKET_SAMPLES, &mean, &error, NULL);
+
+    if (bracket_count < MAX_BRACKETS) {
+        brackets[bracket_count].ref = ref;
+        brackets[bracket_count].cost = mean;
+        bracket_count++;
+    }
+    return mean;
+}
 
-static void clock_compare(const struct clockspec self, const struct clockspec other)
+static void clock_compare(const struct clockspec self, const struct clockspec other,
+                          struct hist *intervals)
 {
-    static double overhead = 0.0;
     uint32_t i, j;
     uint32_t ticks = 0, reads = 0, backwards = 0, jumps = 0, stalls = 0, failures = 0;
+    uint32_t regressions;
     uint64_t s[2], o[2], t[2];
-    char strbuf[2][16];
+    char strbuf[4][16];
     long long delta;
     uint64_t observed_res = (uint64_t)-1;
 
-    double *cost_self, *cost_other;
+    double *cost_self, *cost_other, *cost_direct, *cost_burst, *cost_raw, *grown;
     double cost_self_mean, cost_self_error, cost_other_mean, cost_other_error;
-
-    uint32_t samples = 4;
+    double cost_other_median, cost_gross, bracket;
+    double cost_direct_mean = 0.0, cost_direct_error = 0.0;
+    double cost_burst_mean = 0.0, cost_burst_error = 0.0;
+    double cost_raw_mean = 0.0, cost_raw_error = 0.0;
+    static union clock_raw raw[ITERS_MAX];
+    static uint64_t burst[ITERS_MAX];
+    uint64_t sink;
+    int have_direct, have_raw;
+
+    uint32_t samples = 4, capacity, next_check;
+    uint64_t budget_start;
 
     if (clock_read(self, &t[0]) != 0) {
-        printf("Failed to read from clock '%s' (%u, %u)\n",
-                clock_name(self), self.major, self.minor);
+        printf("%-20s (unavailable)\n", clock_name(self));
         return;
     }
 
@@ -318,16 +590,35 @@ baseline:
     delta /= ticks;
 
     /*
-     * Clamp to either 30 or 200.
+     * Unless told otherwise, take between 30 and 200 samples, fewer for
+     * coarser clocks: all 200 for clocks that tick at least every 5 us, down
+     * to 30 for the coarsest.
      */
-    samples = (uint32_t)fmax(30.0, 1e6 / observed_res);
-    if (samples > 200)
-        samples = 200;
-    else if (samples > 30)
-        samples = 30;
+    if (sample_count)
+        samples = sample_count;
+    else if (precision > 0.0)
+        samples = ADAPTIVE_MAX_SAMPLES;
+    else
+        samples = (uint32_t)fmin(fmax(30.0, 1e6 / observed_res), 200.0);
 
-    cost_self = malloc(sizeof(double) * samples);
-    cost_other = malloc(sizeof(double) * samples);
+    /*
+     * In adaptive mode, 'samples' is only an upper bound, so start small and
+     * grow as needed.
+     */
+    capacity = precision > 0.0 ? ADAPTIVE_MIN_SAMPLES : samples;
+    if (capacity > samples)
+        capacity = samples;
+    next_check = ADAPTIVE_MIN_SAMPLES;
+
+    cost_self = malloc(sizeof(double) * capacity);
+    cost_other = malloc(sizeof(double) * capacity);
+    cost_direct = NULL;
+    cost_burst = NULL;
+    cost_raw = NULL;
+    if (!cost_self || !cost_other) {
+        printf("%-20s (out of memory)\n", clock_name(self));
+        goto cleanup;
+    }
 
     if (reads == ticks) {
         /*
@@ -340,9 +631,22 @@ baseline:
     ticks = 0;
     reads = 0;
 
+    clock_read(other, &budget_start);
     for (j = 0; j < samples; j++) {
         uint32_t sample_reads = 0;
 
+        if (j == capacity) {
+            capacity = capacity * 2 < samples ? capacity * 2 : samples;
+            grown = realloc(cost_self, sizeof(double) * capacity);
+            if (grown)
+                cost_self = grown;
+            grown = grown ? realloc(cost_other, sizeof(double) * capacity) : NULL;
+            if (grown)
+                cost_other = grown;
+            else
+                break;
+        }
+
         /* "Warm" the two clocks up */
         clock_read(other, &o[1]);
         clock_read(self, &s[1]);
@@ -405,35 +709,143 @@ baseline:
         cost_other[j] = (double)(o[1] - o[0]) / (double)sample_reads;
 
         reads += sample_reads;
+
+        /*
+         * Check for convergence every so often, spacing the checks out as
+         * the sample count grows so that they stay linear overall.
+         */
+        if (precision > 0.0) {
+            if (o[1] - budget_start >= (uint64_t)budget_ms * 1000000ULL) {
+                j++;
+                break;
+            }
+            if (j + 1 >= next_check) {
+                calc_error(cost_other, j + 1, &cost_other_mean, &cost_other_error, NULL);
+                if (cost_other_error <= precision) {
+                    j++;
+                    break;
+                }
+                next_check = j + 1 + (j + 1) / 8;
+            }
+        }
     }
+    samples = j;
 
-    calc_error(cost_self, samples, &cost_self_mean, &cost_self_error);
-    calc_error(cost_other, samples, &cost_other_mean, &cost_other_error);
+    cost_direct = malloc(sizeof(double) * samples);
+    cost_burst = malloc(sizeof(double) * samples);
+    cost_raw = malloc(sizeof(double) * samples);
+    if (!cost_direct || !cost_burst || !cost_raw) {
+        printf("%-20s (out of memory)\n", clock_name(self));
+        goto cleanup;
+    }
 
-    /* If we're measuring CPERF_NONE, then we're attempting to detect
-     * measurement overhead.
+    /*
+     * Measure the same clock again with its specialized read loop, which
+     * doesn't go through clock_read() for every reading. The difference
+     * between this and the cost above is the overhead of our own dispatch.
+     */
+    have_direct = clock_read_loop(self, ITERS, &sink) == 0;
+    if (have_direct) {
+        for (j = 0; j < samples; j++) {
+            clock_read(other, &o[0]);
+            clock_read_loop(self, ITERS, &sink);
+            clock_read(other, &o[1]);
+
+            cost_direct[j] = (double)(o[1] - o[0]) / (double)ITERS;
+        }
+        calc_error(cost_direct, samples, &cost_direct_mean, &cost_direct_error, NULL);
+
+        /*
+         * The loops above wait on each reading before taking the next, so
+         * they measure latency. Here, the reads are independent and can
+         * overlap, which is what a caller taking many unrelated timestamps
+         * sees.
+         */
+        for (j = 0; j < samples; j++) {
+            clock_read(other, &o[0]);
+            clock_read_burst(self, burst, ITERS);
+            clock_read(other, &o[1]);
+
+            cost_burst[j] = (double)(o[1] - o[0]) / (double)ITERS;
+        }
+        calc_error(cost_burst, samples, &cost_burst_mean, &cost_burst_error, NULL);
+    }
+
+    /*
+     * And once more storing the raw values, so neither the dispatch nor the
+     * conversion to nanoseconds is part of the cost.
+     */
+    have_raw = do_raw && clock_read_raw_n(self, raw, ITERS) == 0;
+    if (have_raw) {
+        for (j = 0; j < samples; j++) {
+            clock_read(other, &o[0]);
+            clock_read_raw_n(self, raw, ITERS);
+            clock_read(other, &o[1]);
+
+            cost_raw[j] = (double)(o[1] - o[0]) / (double)ITERS;
+        }
+        calc_error(cost_raw, samples, &cost_raw_mean, &cost_raw_error, NULL);
+    }
+
+    calc_error(cost_self, samples, &cost_self_mean, &cost_self_error, NULL);
+    calc_error(cost_other, samples, &cost_other_mean, &cost_other_error,
+               &cost_other_median);
+
+    /*
+     * If we're measuring CPERF_NONE, then we're measuring the overhead of
+     * the harness itself, to take out of the costs of every other clock.
      */
     if (self.major == CPERF_NONE) {
-        /* Assume best case overhead. */
-        overhead = cost_other_mean - (cost_other_mean * (cost_other_error / 100.0));
+        overhead = cost_other_mean;
+        overhead_error = cost_other_mean * (cost_other_error / 100.0);
+
         printf("%-20s %7.2lf %7.2lf%%\n",
             "(overhead)", cost_other_mean, cost_other_error);
         goto cleanup;
     }
 
-    cost_self_mean -= overhead;
-    cost_other_mean -= overhead;
+    regressions = capture_gaps(self, cost_other_mean, &observed_res, intervals);
+
+    cost_gross = cost_other_mean;
+    subtract_overhead(&cost_self_mean, &cost_self_error);
+    subtract_overhead(&cost_other_mean, &cost_other_error);
+    cost_other_median -= overhead;
+    bracket = bracket_overhead(other);
+    cost_direct_mean -= bracket;
+    cost_burst_mean -= bracket;
+    cost_raw_mean -= bracket;
 
     if (observed_res > 0)
         pretty_print(strbuf[0], sizeof(strbuf[0]), 1e9 / observed_res, rate_suffixes, 10);
     else
         strcpy(strbuf[0], "----");
 
-    printf("%-20s %7.2lf %7.2lf%% %8s %5s %5d %5d %5d %5d\n",
-        clock_name(self), cost_other_mean, cost_other_error,
+    if (have_direct)
+        snprintf(strbuf[1], sizeof(strbuf[1]), "%7.2lf", cost_direct_mean);
+    else
+        strcpy(strbuf[1], "----");
+
+    if (have_direct && cost_burst_mean > 0)
+        pretty_print(strbuf[3], sizeof(strbuf[3]), 1e9 / cost_burst_mean, read_rate_suffixes, 10);
+    else
+        strcpy(strbuf[3], "----");
+
+    if (have_raw)
+        snprintf(strbuf[2], sizeof(strbuf[2]), "%7.2lf", cost_raw_mean);
+    else
+        strcpy(strbuf[2], "----");
+
+    printf("%-20s %7.2lf %7.2lf%% %7.2lf %7.2lf %7s %8s", clock_name(self), cost_other_mean,
+        cost_other_error, cost_gross, cost_other_median, strbuf[1], strbuf[3]);
+    if (do_raw)
+        printf(" %7s", strbuf[2]);
+    if (precision > 0.0)
+        printf(" %7" PRIu32, samples);
+    printf(" %8s %5s %5" PRIu32 " %5" PRIu32 " %5" PRIu32 " %5" PRIu32 "\n",
         strbuf[0],
-        (!stalls && !backwards && !jumps && !failures) ? "Yes" : "No",
-        failures / samples, jumps / samples, stalls / samples, backwards / samples);
+        (!stalls && !backwards && !jumps && !failures && !regressions) ? "Yes" : "No",
+        per_sample(failures, samples), per_sample(jumps, samples),
+        per_sample(stalls, samples), per_sample(backwards + regressions, samples));
 
 
     if ((!range_intersects(cost_self_mean, cost_self_error * 2,
@@ -449,49 +861,12 @@ baseline:
 cleanup:
     free(cost_self);
     free(cost_other);
+    free(cost_direct);
+    free(cost_burst);
+    free(cost_raw);
 }
 
 #if 0
-#if defined(TARGET_CPU_X86_64) || defined(TARGET_CPU_X86)
-static int cpuid(uint32_t *_regs)
-{
-#ifdef TARGET_COMPILER_MSVC
-    __cpuidex(_regs, _regs[0], _regs[2]);
-#else
-#ifdef TARGET_CPU_X86
-    static int cpuid_support = 0;
-    if (!cpuid_support) {
-        uint32_t pre_change, post_change;
-        const uint32_t id_flag = 0x200000;
-        asm ("pushfl\n\t"      /* Save %eflags to restore later.  */
-             "pushfl\n\t"      /* Push second copy, for manipulation.  */
-             "popl %1\n\t"     /* Pop it into post_change.  */
-             "movl %1,%0\n\t"  /* Save copy in pre_change.   */
-             "xorl %2,%1\n\t"  /* Tweak bit in post_change.  */
-             "pushl %1\n\t"    /* Push tweaked copy... */
-             "popfl\n\t"       /* ... and pop it into %eflags.  */
-             "pushfl\n\t"      /* Did it change?  Push new %eflags... */
-             "popl %1\n\t"     /* ... and pop it into post_change.  */
-             "popfl"           /* Restore original value.  */
-             : "=&r" (pre_change), "=&r" (post_change)
-             : "ir" (id_flag));
-        if (((pre_change ^ post_change) & id_flag) == 0)
-            return 1;
-        cpuid_support = 1;
-    }
-#endif
-    asm volatile(
-        "cpuid"
-        : "=a" (_regs[0]),
-          "=b" (_regs[1]),
-          "=c" (_regs[2]),
-          "=d" (_regs[3])
-        : "0" (_regs[0]), "2" (_regs[2]));
-#endif
-    return 0;
-}
-#endif
-
 /*
  * int have_invariant_tsc(void)
  *
@@ -540,6 +915,204 @@ static int have_invariant_tsc(void)
 }
 #endif
 
+#ifdef HAVE_CPU_CLOCK
+/*
+ * Report how well the CPU clock frequency was measured, if it was measured
+ * at all.
+ */
+static void report_calibration(void)
+{
+    struct cpu_clock_calibration cal;
+
+    if (cpu_clock_get_calibration(&cal))
+        return;
+
+    printf("== TSC Calibration ==\n\n");
+    printf("%-22s %" PRIu32 " ms, %" PRIu32 " samples\n",
+            "window", cal.window_ms, cal.samples);
+    printf("%-22s %.6lf MHz +/- %.3lf ppm (95%%)\n",
+            "frequency", cal.hz / 1e6, cal.ci_ppm);
+    printf("%-22s %.1lf ns stddev, %.1lf ns max\n",
+            "residuals", cal.resid_stddev_ns, cal.resid_max_ns);
+    if (cal.known_hz > 0.0 && cal.known_source)
+        printf("%-22s %.6lf MHz, %+.3lf ppm\n",
+                cal.known_source, cal.known_hz / 1e6,
+                (cal.hz / cal.known_hz - 1.0) * 1e6);
+    printf("\n\n");
+}
+#endif
+
+#if defined(HAVE_CPU_CLOCK) && defined(HAVE_PERF_TIMEBASE)
+/*
+ * Compare the kernel's TSC conversion, as published for perf, against the
+ * one we use and against our own measurement of the TSC frequency. The one
+ * we use may have come from the kernel or from a nominal CPUID value, so
+ * only the measurement is an independent check.
+ */
+static void report_perf_timebase(void)
+{
+    struct cpu_clock_calibration cal;
+    uint32_t kmult, shift;
+    uint16_t kshift;
+    uint64_t zero, mult;
+    double kns, ns, hz;
+
+    if (perf_timebase_params(&kmult, &kshift, &zero))
+        return;
+    if (cpu_clock_mult_shift(&mult, &shift))
+        return;
+    hz = cpu_clock_measure_hz();
+    if (!(hz > 0.0) || cpu_clock_get_calibration(&cal))
+        return;
+
+    kns = (double)kmult / (double)(1ULL << kshift);
+    ns = (double)mult / (double)(1ULL << shift);
+
+    printf("== TSC Conversion (kernel perf vs. measured) ==\n\n");
+    printf("%-22s mult %10" PRIu32 " shift %2u  %.3lf MHz\n",
+            "kernel", kmult, kshift, 1e3 / kns);
+    printf("%-22s mult %10" PRIu64 " shift %2u  %.3lf MHz\n",
+            cpu_clock_freq_source(), mult, shift, 1e3 / ns);
+    printf("%-22s %.3lf MHz +/- %.3lf ppm (95%%)\n",
+            "measured", hz / 1e6, cal.ci_ppm);
+    printf("%-22s %+.2lf ppm\n", "difference", (1e9 / kns / hz - 1.0) * 1e6);
+    printf("\n\n");
+}
+#endif
+
+/*
+ * Tail latency, from the gaps between consecutive readings in each clock's
+ * back-to-back capture. For clocks that tick slower than they can be read,
+ * this is mostly the tick size rather than the cost of a read.
+ */
+static void report_intervals(struct hist **intervals)
+{
+    struct clockspec *p;
+    uint32_t i;
+
+    printf("== Read-to-Read Intervals (ns) ==\n\n");
+    printf("Name                     p50      p90      p99    p99.9   p99.99        max\n");
+    for (i = 0, p = clock_sources; p->major != CPERF_NULL; i++, p++) {
+        struct hist *h = intervals[i];
+
+        if (!h || !h->count)
+            continue;
+        printf("%-20s %8" PRIu64 " %8" PRIu64 " %8" PRIu64 " %8" PRIu64 " %8" PRIu64 " %10" PRIu64 "\n",
+                clock_name(*p),
+                hist_percentile(h, 50.0), hist_percentile(h, 90.0),
+                hist_percentile(h, 99.0), hist_percentile(h, 99.9),
+                hist_percentile(h, 99.99), h->max);
+    }
+    printf("\n\n");
+
+    if (!do_histogram)
+        return;
+
+    for (i = 0, p = clock_sources; p->major != CPERF_NULL; i++, p++) {
+        struct hist *h = intervals[i];
+
+        if (!h || !h->count)
+            continue;
+        printf("== Read-to-Read Histogram: %s (ns) ==\n\n", clock_name(*p));
+        hist_dump(h, stdout);
+        printf("\n\n");
+    }
+}
+
+static void behavior_tests(const char *title)
+{
+    struct hist *intervals[MAX_CLOCK_SOURCES];
+    struct clockspec null_clock = {CPERF_NONE, 0};
+    struct clockspec *p;
+    uint32_t i;
+
+    printf("== Clock Behavior Tests%s ==\n\n", title ? title : "");
+
+    printf("Name                Cost(ns)      +/-   Gross  Median  Direct  Reads/s");
+    if (do_raw)
+        printf("     Raw");
+    if (precision > 0.0)
+        printf(" Samples");
+    printf("    Resol  Mono  Fail  Warp  Stal  Regr\n");
+
+    /* Calibrate the harness overhead first, so it can be taken out below. */
+    overhead = overhead_error = 0.0;
+    bracket_count = 0;
+    clock_choose_ref(null_clock);
+    clock_compare(null_clock, ref_clock, NULL);
+
+    for (i = 0, p = clock_sources; p->major != CPERF_NULL; i++, p++) {
+        intervals[i] = malloc(sizeof(struct hist));
+        if (intervals[i])
+            hist_init(intervals[i]);
+        clock_choose_ref(*p);
+        clock_compare(*p, ref_clock, intervals[i]);
+    }
+    printf("\n\n");
+
+    report_intervals(intervals);
+
+    for (i = 0, p = clock_sources; p->major != CPERF_NULL; i++, p++)
+        free(intervals[i]);
+}
+
+#ifdef HAVE_KERNEL_CLOCKSOURCE
+static char original_clocksource[64];
+
+static void restore_clocksource(int sig)
+{
+    clocksource_set(original_clocksource);
+    _exit(128 + sig);
+}
+
+/*
+ * Rerun the behavior tests once for each clocksource the kernel offers,
+ * switching between them through sysfs, then put the original one back.
+ */
+static int sweep_clocksources(void)
+{
+    char available[512], title[96];
+    char *name, *saveptr = NULL;
+
+    if (geteuid() != 0) {
+        printf("error: switching kernel clocksources requires root\n");
+        return 1;
+    }
+    if (clocksource_current(original_clocksource, sizeof(original_clocksource))
+        || clocksource_available(available, sizeof(available))) {
+        printf("error: could not read kernel clocksources from sysfs\n");
+        return 1;
+    }
+
+    signal(SIGINT, restore_clocksource);
+    signal(SIGTERM, restore_clocksource);
+
+    for (name = strtok_r(available, " ", &saveptr); name;
+         name = strtok_r(NULL, " ", &saveptr)) {
+        char current[64];
+
+        if (clocksource_set(name)
+            || clocksource_current(current, sizeof(current))
+            || strcmp(current, name) != 0) {
+            printf("== Kernel clocksource '%s' could not be selected, skipping ==\n\n\n", name);
+            continue;
+        }
+
+        snprintf(title, sizeof(title), " (kernel clocksource: %s)", name);
+        behavior_tests(title);
+    }
+
+    if (clocksource_set(original_clocksource)) {
+        printf("error: failed to restore kernel clocksource '%s'\n", original_clocksource);
+        return 1;
+    }
+
+    signal(SIGINT, SIG_DFL);
+    signal(SIGTERM, SIG_DFL);
+    return 0;
+}
+#endif
+
 static void version(void)
 {
     printf("clockperf v%s\n\n", clockperf_version_long());
@@ -548,7 +1121,14 @@ static void version(void)
 static void usage(const char *argv0)
 {
     printf("usage:\n");
-    printf("  %s [--drift [clocksource] | --monitor [clocksource]] [--ref reference-clocksource]\n", argv0);
+    printf("  %s [--drift [clocksource] | --monitor [clocksource]] [--ref reference-clocksource] [--duration ms] [--interval ms] [--warmup ms] [--cpus list] [--tsc-convert engine] [--raw] [--histogram] [--samples N] [--confidence PCT] [--precision PCT [--budget ms]]\n", argv0);
+    printf("  %s --scale [clocksource] [--ref reference-clocksource] [--cpus list]\n", argv0);
+    printf("  %s --hwlat [clocksource] [--threshold ns] [--duration ms] [--cpus list]\n", argv0);
+    printf("  %s --pingpong [clocksource] [--cpus list]\n", argv0);
+    printf("  %s --offsets [clocksource] [--cpus list]\n", argv0);
+    printf("  %s --calibrate [milliseconds]\n", argv0);
+    printf("  %s --convert-bench [days]\n", argv0);
+    printf("  %s --sweep\n", argv0);
     printf("  %s --list\n", argv0);
 }
 
@@ -566,13 +1146,47 @@ static void usage(const char *argv0)
         } \
     } while(0);
 
+#define MAX_CPU_LIST 4096
+
 /* < 0   do all drift tests
  *   0   do no drift tests
  * > 0   do drift test for specific clock
  */
 static int do_drift;
 static int do_monitor;
+static int do_scale;
+static int do_hwlat;
+static int do_pingpong;
+static int do_offsets;
+
+/*
+ * Settings for --hwlat: how long to spin on each CPU and the shortest gap to
+ * report. The CPU list is shared with --drift, --scale, --pingpong and
+ * --offsets, and means all CPUs we may run on if 'cpu_count' is 0. A
+ * 'duration_ms' of 0 means the mode's own default, as --duration is shared
+ * with --drift.
+ */
+static uint32_t duration_ms;
+static uint64_t threshold_ns = 10000;
+static uint32_t cpu_list[MAX_CPU_LIST];
+static uint32_t cpu_count;
+
+/*
+ * Settings for --drift: the time between rounds, and how long to run rounds
+ * before any are reported.
+ */
+static uint32_t interval_ms = 1000;
+static uint32_t warmup_ms;
+
+static void default_cpu_list(void)
+{
+    if (cpu_count)
+        return;
+    cpu_count = thread_allowed_cpus(cpu_list, MAX_CPU_LIST);
+}
 static int do_list;
+static int do_sweep;
+static int do_convert_bench;
 static int ref_index;
 
 int main(int argc, char **argv)
@@ -582,14 +1196,37 @@ int main(int argc, char **argv)
 
     version();
 
+#ifdef HAVE_DYNAMIC_CLOCKS
+    add_dynamic_clocks();
+#endif
+
     while (1) {
         static struct option long_options[] = {
             {"version", no_argument, 0, 'v'},
             {"help", no_argument, 0, 'h'},
             {"drift", optional_argument, 0, 'd'},
             {"monitor", optional_argument, 0, 'm'},
+            {"scale", optional_argument, 0, 'S'},
+            {"hwlat", optional_argument, 0, 'w'},
+            {"pingpong", optional_argument, 0, 'o'},
+            {"offsets", optional_argument, 0, 'O'},
+            {"threshold", required_argument, 0, 'T'},
+            {"duration", required_argument, 0, 'D'},
+            {"cpus", required_argument, 0, 'P'},
+            {"interval", required_argument, 0, 'I'},
+            {"warmup", required_argument, 0, 'W'},
             {"ref", optional_argument, 0, 'r'},
             {"list", optional_argument, 0, 'l'},
+            {"sweep", no_argument, 0, 's'},
+            {"calibrate", optional_argument, 0, 'c'},
+            {"tsc-convert", required_argument, 0, 't'},
+            {"raw", no_argument, 0, 'R'},
+            {"histogram", no_argument, 0, 'H'},
+            {"convert-bench", optional_argument, 0, 'b'},
+            {"samples", required_argument, 0, 'n'},
+            {"confidence", required_argument, 0, 'C'},
+            {"precision", required_argument, 0, 'p'},
+            {"budget", required_argument, 0, 'B'},
             {0, 0, 0, 0}
         };
         int c, option_index = 0;
@@ -602,6 +1239,10 @@ int main(int argc, char **argv)
             break;
         case 'd':
         case 'm':
+        case 'S':
+        case 'w':
+        case 'o':
+        case 'O':
         case 'r':
             {
                 int v = -1;
@@ -630,6 +1271,14 @@ int main(int argc, char **argv)
                     do_drift = v;
                 else if (c == 'm')
                     do_monitor = v;
+                else if (c == 'S')
+                    do_scale = v;
+                else if (c == 'w')
+                    do_hwlat = v;
+                else if (c == 'o')
+                    do_pingpong = v;
+                else if (c == 'O')
+                    do_offsets = v;
                 else if (c == 'r')
                     ref_index = v;
             }
@@ -637,6 +1286,133 @@ int main(int argc, char **argv)
         case 'l':
             do_list = 1;
             break;
+        case 's':
+            do_sweep = 1;
+            break;
+        case 'R':
+            do_raw = 1;
+            break;
+        case 'H':
+            do_histogram = 1;
+            break;
+        case 'c':
+            {
+                int ms = 1000;
+                FIX_OPTARG();
+                if (optarg) {
+                    ms = atoi(optarg);
+                    if (ms <= 0) {
+                        printf("error: invalid calibration window '%s'\n", optarg);
+                        return 1;
+                    }
+                }
+                cpu_clock_set_calibration(ms);
+            }
+            break;
+        case 't':
+            {
+                int engine = tsc_convert_lookup(optarg);
+                if (engine < 0 || cpu_clock_set_convert(engine)) {
+                    printf("error: unsupported TSC conversion '%s'\n", optarg);
+                    return 1;
+                }
+            }
+            break;
+        case 'b':
+            FIX_OPTARG();
+            do_convert_bench = 7;
+            if (optarg) {
+                do_convert_bench = atoi(optarg);
+                if (do_convert_bench <= 0) {
+                    printf("error: invalid number of days '%s'\n", optarg);
+                    return 1;
+                }
+            }
+            break;
+        case 'n':
+            {
+                int n = atoi(optarg);
+                if (n < 2) {
+                    printf("error: invalid number of samples '%s'\n", optarg);
+                    return 1;
+                }
+                sample_count = n;
+            }
+            break;
+        case 'C':
+            confidence = atof(optarg);
+            if (!(confidence > 0.0 && confidence < 100.0)) {
+                printf("error: invalid confidence level '%s'\n", optarg);
+                return 1;
+            }
+            break;
+        case 'T':
+            {
+                long long ns = atoll(optarg);
+                if (ns <= 0) {
+                    printf("error: invalid threshold '%s'\n", optarg);
+                    return 1;
+                }
+                threshold_ns = ns;
+            }
+            break;
+        case 'D':
+            {
+                int ms = atoi(optarg);
+                if (ms <= 0) {
+                    printf("error: invalid duration '%s'\n", optarg);
+                    return 1;
+                }
+                duration_ms = ms;
+            }
+            break;
+        case 'I':
+            {
+                int ms = atoi(optarg);
+                if (ms <= 0) {
+                    printf("error: invalid interval '%s'\n", optarg);
+                    return 1;
+                }
+                interval_ms = ms;
+            }
+            break;
+        case 'W':
+            {
+                int ms = atoi(optarg);
+                if (ms < 0) {
+                    printf("error: invalid warm-up '%s'\n", optarg);
+                    return 1;
+                }
+                warmup_ms = ms;
+            }
+            break;
+        case 'P':
+            {
+                int n = thread_parse_cpus(optarg, cpu_list, MAX_CPU_LIST);
+                if (n <= 0) {
+                    printf("error: invalid CPU list '%s'\n", optarg);
+                    return 1;
+                }
+                cpu_count = n;
+            }
+            break;
+        case 'p':
+            precision = atof(optarg);
+            if (!(precision > 0.0)) {
+                printf("error: invalid precision '%s'\n", optarg);
+                return 1;
+            }
+            break;
+        case 'B':
+            {
+                int ms = atoi(optarg);
+                if (ms <= 0) {
+                    printf("error: invalid time budget '%s'\n", optarg);
+                    return 1;
+                }
+                budget_ms = ms;
+            }
+            break;
         case 'v':
             /* We already printed the version. Only print the license. */
             license();
@@ -652,20 +1428,43 @@ int main(int argc, char **argv)
     timers_init();
     thread_init();
     cpu_clock_init();
-    cpu_clock_calibrate();
+#ifdef HAVE_VDSO
+    vdso_init();
+#endif
+#ifdef HAVE_PERF_TIMEBASE
+    perf_timebase_init();
+#endif
 #ifdef HAVE_DRIFT_TESTS
-    if (do_drift)
-        drift_init();
+    if (do_drift) {
+        default_cpu_list();
+        drift_init(cpu_list, cpu_count);
+    }
 #endif
 
 #if 0
     printf("Invariant TSC: %s\n\n", have_invariant_tsc() ? "Yes" : "No");
 #endif
 
+#ifdef HAVE_KERNEL_CLOCKSOURCE
+    {
+        char current[64], available[512];
+
+        if (!clocksource_current(current, sizeof(current))) {
+            printf("Kernel clocksource: %s\n", current);
+            if (!clocksource_available(available, sizeof(available)))
+                printf("Available:          %s\n", available);
+            printf("\n");
+        }
+    }
+#endif
+
     if (do_list) {
         printf("== Clocksources Supported in This Build ==\n\n");
 
+        /* The ordered TSC variants are only listed where CPUID has them. */
         for (p = clock_sources; p->major != CPERF_NULL; p++) {
+            if (!clock_cpu_supported(*p))
+                continue;
             printf("%-22s\n",
                     clock_name(*p));
         }
@@ -673,7 +1472,23 @@ int main(int argc, char **argv)
         return 0;
     }
 
-    if (do_drift <= 0 && !do_monitor) {
+    /*
+     * Every other mode reads a TSC-based clock, if only as the reference for
+     * another one, so settle its frequency now, before any thread reads it.
+     */
+    cpu_clock_calibrate();
+
+#ifdef HAVE_CPU_CLOCK
+    if (do_convert_bench) {
+        struct clockspec tsc = {CPERF_TSC, 0};
+
+        clock_choose_ref(tsc);
+        return tsc_convert_bench(cpu_clock_hz(), do_convert_bench, ref_clock);
+    }
+#endif
+
+    if (do_drift <= 0 && !do_monitor && !do_scale && !do_hwlat && !do_pingpong
+        && !do_offsets) {
         printf("== Reported Clock Frequencies ==\n\n");
 
         for (p = clock_sources; p->major != CPERF_NULL; p++) {
@@ -683,29 +1498,52 @@ int main(int argc, char **argv)
             if (clock_resolution(*p, &res) != 0)
                 continue;
 
-            printf("%-22s %s\n",
+            printf("%-22s %s",
                     clock_name(*p),
                     pretty_print(buf, sizeof(buf), (double)res, rate_suffixes, 10));
+#ifdef HAVE_CPU_CLOCK
+            if (p->major == CPERF_TSC)
+                printf(" (%s)", cpu_clock_freq_source());
+#endif
+            printf("\n");
         }
         printf("\n\n");
 
-        printf("== Clock Behavior Tests ==\n\n");
+#ifdef HAVE_CPU_CLOCK
+        report_calibration();
+#endif
+#if defined(HAVE_CPU_CLOCK) && defined(HAVE_PERF_TIMEBASE)
+        report_perf_timebase();
+#endif
 
-        printf("Name                Cost(ns)      +/-    Resol  Mono  Fail  Warp  Stal  Regr\n");
-        for (p = clock_sources; p->major != CPERF_NULL; p++) {
-            clock_choose_ref(*p);
-            clock_compare(*p, ref_clock);
+        if (do_sweep) {
+#ifdef HAVE_KERNEL_CLOCKSOURCE
+            if (sweep_clocksources())
+                return 1;
+#else
+            printf("error: switching kernel clocksources is not supported on this platform\n");
+            return 1;
+#endif
+        } else {
+            behavior_tests(NULL);
         }
-        printf("\n\n");
     }
 
     if (do_drift) {
         printf("== Clock Drift Tests ==\n");
 #ifdef HAVE_DRIFT_TESTS
         for (i = 0, p = clock_sources; p->major != CPERF_NULL; i++, p++) {
+            uint64_t v;
+
             if (do_drift > 0 && i != do_drift - 1)
                 continue;
 
+            if (clock_read(*p, &v) != 0) {
+                printf("\n%9s: %s (unavailable, skipping)\n",
+                    "Primary", clock_name(*p));
+                continue;
+            }
+
             if (ref_index > 0 && do_drift > 0)
                 clock_set_ref(clock_sources[ref_index - 1]);
             else
@@ -714,16 +1552,147 @@ int main(int argc, char **argv)
             printf("\n%9s: %s\n%9s: %s\n",
                 "Primary", clock_name(*p),
                 "Reference", clock_name(ref_clock));
-            drift_run(do_drift > 0 ? 60000 : 10000, *p, ref_clock);
+            drift_run(duration_ms ? duration_ms : (do_drift > 0 ? 60000 : 10000),
+                      interval_ms, warmup_ms, *p, ref_clock, do_raw);
         }
 #else
         printf("error: support for clock drift tests is not compiled in to this build\n");
 #endif
     }
 
+    if (do_scale) {
+        printf("== Clock Scalability Tests ==\n");
+#ifdef HAVE_SCALE_TESTS
+        default_cpu_list();
+        for (i = 0, p = clock_sources; p->major != CPERF_NULL; i++, p++) {
+            uint64_t v;
+
+            if (do_scale > 0 && i != do_scale - 1)
+                continue;
+
+            if (clock_read(*p, &v) != 0) {
+                printf("\n%9s: %s (unavailable, skipping)\n",
+                    "Primary", clock_name(*p));
+                continue;
+            }
+
+            if (ref_index > 0 && do_scale > 0)
+                clock_set_ref(clock_sources[ref_index - 1]);
+            else
+                clock_choose_ref(*p);
+
+            printf("\n%9s: %s\n%9s: %s\n\n",
+                "Primary", clock_name(*p),
+                "Reference", clock_name(ref_clock));
+            scale_run(do_scale > 0 ? 1000 : 200, *p, ref_clock, cpu_list, cpu_count);
+        }
+        printf("\n");
+#else
+        printf("error: support for clock scalability tests is not compiled in to this build\n");
+#endif
+    }
+
+    if (do_hwlat) {
+        uint64_t v;
+
+        /* Without a specific clock, use the first one that works. */
+        for (i = 0, p = clock_sources; p->major != CPERF_NULL; i++, p++) {
+            if (do_hwlat > 0 && i != do_hwlat - 1)
+                continue;
+            if (clock_read(*p, &v) == 0)
+                break;
+            if (do_hwlat > 0) {
+                printf("error: clock '%s' is unavailable\n", clock_name(*p));
+                return 1;
+            }
+        }
+        if (p->major == CPERF_NULL) {
+            printf("error: no usable clock for the gap detector\n");
+            return 1;
+        }
+
+        default_cpu_list();
+
+        if (!duration_ms)
+            duration_ms = 1000;
+
+        printf("== Hardware/OS Latency Gaps ==\n\n");
+        printf("%9s: %s\n%9s: %" PRIu64 " ns\n%9s: %" PRIu32 " ms per CPU\n\n",
+            "Clock", clock_name(*p),
+            "Threshold", threshold_ns,
+            "Duration", duration_ms);
+        if (hwlat_run(*p, duration_ms, threshold_ns, cpu_list, cpu_count))
+            return 1;
+        printf("\n");
+    }
+
+    if (do_pingpong) {
+        printf("== Cross-CPU Monotonicity (Ping-Pong) Tests ==\n");
+#ifdef HAVE_PINGPONG_TESTS
+        default_cpu_list();
+        for (i = 0, p = clock_sources; p->major != CPERF_NULL; i++, p++) {
+            uint64_t v;
+
+            if (do_pingpong > 0 && i != do_pingpong - 1)
+                continue;
+
+            if (clock_read(*p, &v) != 0) {
+                printf("\n%9s: %s (unavailable, skipping)\n",
+                    "Primary", clock_name(*p));
+                continue;
+            }
+
+            if (clock_is_cpu_time(*p)) {
+                printf("\n%9s: %s (CPU time, skipping)\n",
+                    "Primary", clock_name(*p));
+                continue;
+            }
+
+            printf("\n%9s: %s\n\n", "Primary", clock_name(*p));
+            if (pingpong_run(*p, cpu_list, cpu_count))
+                return 1;
+        }
+        printf("\n");
+#else
+        printf("error: support for ping-pong tests is not compiled in to this build\n");
+#endif
+    }
+
+    if (do_offsets) {
+        printf("== Cross-CPU Clock Offsets ==\n");
+#ifdef HAVE_PINGPONG_TESTS
+        default_cpu_list();
+        for (i = 0, p = clock_sources; p->major != CPERF_NULL; i++, p++) {
+            uint64_t v;
+
+            if (do_offsets > 0 && i != do_offsets - 1)
+                continue;
+
+            if (clock_read(*p, &v) != 0) {
+                printf("\n%9s: %s (unavailable, skipping)\n",
+                    "Primary", clock_name(*p));
+                continue;
+            }
+
+            if (clock_is_cpu_time(*p)) {
+                printf("\n%9s: %s (CPU time, skipping)\n",
+                    "Primary", clock_name(*p));
+                continue;
+            }
+
+            printf("\n%9s: %s\n\n", "Primary", clock_name(*p));
+            if (offset_run(*p, cpu_list, cpu_count))
+                return 1;
+        }
+        printf("\n");
+#else
+        printf("error: support for clock offset tests is not compiled in to this build\n");
+#endif
+    }
+
     if (do_monitor) {
-        uint64_t base_values[CPERF_NUM_CLOCKS];
-        uint64_t current_values[CPERF_NUM_CLOCKS];
+        uint64_t base_values[sizeof(clock_sources) / sizeof(clock_sources[0])];
+        uint64_t current_values[sizeof(clock_sources) / sizeof(clock_sources[0])];
 
         uint64_t wall_time_base, wall_time;
 
@@ -750,7 +1719,10 @@ int main(int argc, char **argv)
             for (i = 0, p = clock_sources; p->major != CPERF_NULL; i++, p++) {
                 if (do_monitor > 0 && i != do_monitor - 1)
                     continue;
-                clock_read(*p, &current_values[i]);
+                if (base_values[i] == ~0ULL)
+                    continue;
+                if (clock_read(*p, &current_values[i]))
+                    continue;
                 printf("%22s: +%-20" PRIu64 " ms (%-20" PRIu64 " ms)\n", clock_name(*p),
                         (current_values[i] - base_values[i]) / 1000000,
                         current_values[i] / 1000000);
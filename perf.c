@@ -0,0 +1,99 @@
+/*
+ * clockperf
+ *
+ * Copyright (c) 2016-2021, Steven Noonan <steven@uplinklabs.net>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ */
+
+#include "prefix.h"
+#include "perf.h"
+
+#ifdef HAVE_PERF_TIMEBASE
+
+#include <sys/mman.h>
+
+volatile struct perf_event_mmap_page *perf_page;
+
+/*
+ * Open a software perf event on ourselves purely to get at the event's user
+ * page. The kernel publishes its TSC to perf clock conversion there
+ * (time_mult, time_shift and time_zero), which is what perf tooling uses to
+ * turn raw TSC readings into timestamps.
+ *
+ * Returns zero if the page is mapped and the kernel says the conversion
+ * fields are usable.
+ */
+int perf_timebase_init(void)
+{
+    struct perf_event_attr attr;
+    void *page;
+    long pagesize;
+    int fd;
+
+    if (perf_page)
+        return 0;
+
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_SOFTWARE;
+    attr.config = PERF_COUNT_SW_DUMMY;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+
+    fd = (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+    if (fd < 0)
+        return 1;
+
+    pagesize = sysconf(_SC_PAGESIZE);
+    page = mmap(NULL, pagesize, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (page == MAP_FAILED)
+        return 1;
+
+    perf_page = (volatile struct perf_event_mmap_page *)page;
+    if (!perf_page->cap_user_time || !perf_page->cap_user_time_zero) {
+        munmap(page, pagesize);
+        perf_page = NULL;
+        return 1;
+    }
+
+    return 0;
+}
+
+/*
+ * Take a consistent snapshot of the kernel's conversion parameters.
+ */
+int perf_timebase_params(uint32_t *mult, uint16_t *shift, uint64_t *zero)
+{
+    uint32_t seq;
+
+    if (!perf_page)
+        return 1;
+
+    do {
+        seq = perf_page->lock;
+        __asm__ __volatile__("" ::: "memory");
+        *mult = perf_page->time_mult;
+        *shift = perf_page->time_shift;
+        *zero = perf_page->time_zero;
+        __asm__ __volatile__("" ::: "memory");
+    } while (perf_page->lock != seq);
+
+    return 0;
+}
+
+#endif
+
+/* vim: set ts=4 sts=4 sw=4 et: */
@@ -0,0 +1,41 @@
+/*
+ * clockperf
+ *
+ * Copyright (c) 2016-2021, Steven Noonan <steven@uplinklabs.net>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ */
+
+#pragma once
+
+#include "platform.h"
+
+/*
+ * The perf_event user page only describes the TSC conversion on x86.
+ */
+#if defined(TARGET_OS_LINUX) \
+    && (defined(TARGET_CPU_X86) || defined(TARGET_CPU_X86_64))
+#define HAVE_PERF_TIMEBASE
+#endif
+
+#ifdef HAVE_PERF_TIMEBASE
+#include <linux/perf_event.h>
+
+extern volatile struct perf_event_mmap_page *perf_page;
+
+int perf_timebase_init(void);
+int perf_timebase_params(uint32_t *mult, uint16_t *shift, uint64_t *zero);
+#endif
+
+/* vim: set ts=4 sts=4 sw=4 et: */
@@ -0,0 +1,448 @@
+/*
+ * clockperf
+ *
+ * Copyright (c) 2016-2021, Steven Noonan <steven@uplinklabs.net>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ */
+
+#include "prefix.h"
+#include "affinity.h"
+#include "clock.h"
+#include "pingpong.h"
+#include "sync.h"
+
+#ifdef HAVE_PINGPONG_TESTS
+
+/*
+ * Handoffs in each direction between every pair of CPUs.
+ */
+#define PINGPONG_ROUNDS 1000
+
+/*
+ * Round trips between every pair of CPUs when estimating their offset.
+ */
+#define OFFSET_ROUNDS 1000
+
+/*
+ * The cacheline the two threads pass back and forth. 'seq' is the number of
+ * the last handoff, and 'stamp' is the clock reading its publisher took
+ * right before it. The offset exchange uses 'recv' and 'send' for the
+ * replying side's two timestamps instead, and those are published by the
+ * release store to 'seq' like 'stamp' is. The struct is cacheline aligned,
+ * and its size rounds up to a whole number of lines, so the padding keeps
+ * anything else off the line.
+ */
+struct pingpong_line {
+    SYNC_ALIGN(64) char pad0[64];
+    sync_u32 seq;
+    uint64_t stamp;
+    uint64_t recv;
+    uint64_t send;
+};
+
+typedef void (*pingpong_fn)(struct clockspec clk, uint32_t side, void *result);
+
+/*
+ * Control for one pair of threads: a barrier to start together once both
+ * are pinned, and whether either failed to pin.
+ */
+struct pingpong_ctl {
+    sync_u32 ready;
+    sync_u32 failed;
+};
+
+/*
+ * The side of a pair that runs on a thread of its own.
+ */
+struct pingpong_worker {
+    struct thread_handle thread;
+    struct clockspec clk;
+    uint32_t cpu;
+    pingpong_fn fn;
+    void *result;
+};
+
+/*
+ * What one side saw of the other side's stamps: how many were later than
+ * its own reading after observing them, and the worst of those, in ns.
+ */
+struct pingpong_seen {
+    uint64_t violations;
+    uint64_t worst;
+};
+
+/*
+ * Reads spent looking for each tick when measuring a clock's tick size.
+ */
+#define TICK_MAX_READS (1U << 20)
+
+/*
+ * The best round trip the offset exchange saw: the offset of the replying
+ * side's clock from the requesting side's, and the round trip delay it was
+ * estimated from, which bounds its error to +/- half of it plus one tick of
+ * the clock. 'delay' is UINT64_MAX if no round was usable.
+ */
+struct offset_est {
+    int64_t offset;
+    uint64_t delay;
+};
+
+static struct pingpong_line line;
+static struct pingpong_ctl ctl;
+
+/*
+ * One side of the ping-pong. Side 0 publishes the odd handoffs and side 1
+ * the even ones. Each side waits for the other's handoff, reads the clock
+ * as soon as it sees it, and compares that to the publisher's stamp, then
+ * stamps and publishes its own.
+ */
+static void pingpong_side(struct clockspec clk, uint32_t side, void *result)
+{
+    struct pingpong_seen *seen = (struct pingpong_seen *)result;
+    const uint32_t last = 2 * PINGPONG_ROUNDS;
+    uint64_t now, stamp;
+    uint32_t v;
+
+    for (v = side + 1; v <= last + 1; v += 2) {
+        if (v > 1) {
+            /* No pause while spinning, it would only add to the handoff. */
+            while (sync_load(&line.seq) != v - 1)
+                ;
+            clock_read(clk, &now);
+            stamp = line.stamp;
+            if (now < stamp) {
+                seen->violations++;
+                if (stamp - now > seen->worst)
+                    seen->worst = stamp - now;
+            }
+        }
+        if (v <= last) {
+            clock_read(clk, &stamp);
+            line.stamp = stamp;
+            sync_store(&line.seq, v);
+        }
+    }
+}
+
+/*
+ * One side of an NTP-style offset exchange. Side 0 stamps t1 and sends a
+ * request, side 1 stamps t2 when it sees it and t3 as it replies, and side 0
+ * stamps t4 when it sees the reply. Side 0 keeps the round with the shortest
+ * round trip, (t4 - t1) - (t3 - t2), since it had the least room for error.
+ */
+static void offset_side(struct clockspec clk, uint32_t side, void *result)
+{
+    struct offset_est *best = (struct offset_est *)result;
+    uint64_t t1, t2, t3, t4, delay;
+    uint32_t round;
+
+    best->delay = UINT64_MAX;
+    best->offset = 0;
+    for (round = 0; round < OFFSET_ROUNDS; round++) {
+        if (side == 0) {
+            clock_read(clk, &t1);
+            sync_store(&line.seq, 2 * round + 1);
+            while (sync_load(&line.seq) != 2 * round + 2)
+                ;
+            clock_read(clk, &t4);
+            t2 = line.recv;
+            t3 = line.send;
+
+            delay = (t4 - t1) - (t3 - t2);
+            if ((int64_t)delay >= 0 && delay < best->delay) {
+                best->delay = delay;
+                best->offset = ((int64_t)(t2 - t1) + (int64_t)(t3 - t4)) / 2;
+            }
+        } else {
+            while (sync_load(&line.seq) != 2 * round + 1)
+                ;
+            clock_read(clk, &t2);
+            clock_read(clk, &t3);
+            line.recv = t2;
+            line.send = t3;
+            sync_store(&line.seq, 2 * round + 2);
+        }
+    }
+}
+
+static void pingpong_worker(void *arg)
+{
+    struct pingpong_worker *worker = (struct pingpong_worker *)arg;
+
+    if (thread_bind(worker->cpu))
+        sync_store(&ctl.failed, 1);
+    sync_barrier(&ctl.ready, 2);
+    if (!sync_load(&ctl.failed))
+        worker->fn(worker->clk, 1, worker->result);
+}
+
+/*
+ * Run 'fn' on two threads pinned to 'cpu_a' (side 0, with 'result_a') and
+ * 'cpu_b' (side 1, with 'result_b'). Side 0 is the calling thread.
+ *
+ * Returns zero on success, nonzero if the two threads couldn't be started
+ * and pinned.
+ */
+static int pingpong_pair(struct clockspec clk, uint32_t cpu_a, uint32_t cpu_b,
+                         pingpong_fn fn, void *result_a, void *result_b)
+{
+    struct pingpong_worker worker;
+
+    sync_init(&line.seq, 0);
+    line.stamp = 0;
+    sync_init(&ctl.ready, 0);
+    sync_init(&ctl.failed, 0);
+
+    worker.clk = clk;
+    worker.cpu = cpu_b;
+    worker.fn = fn;
+    worker.result = result_b;
+    if (thread_start(&worker.thread, pingpong_worker, &worker))
+        return 1;
+
+    if (thread_bind(cpu_a))
+        sync_store(&ctl.failed, 1);
+    sync_barrier(&ctl.ready, 2);
+    if (!sync_load(&ctl.failed))
+        fn(clk, 0, result_a);
+
+    thread_join(&worker.thread);
+    return sync_load(&ctl.failed) ? 1 : 0;
+}
+
+/*
+ * Run the ping-pong between every pair of the given CPUs, and print a
+ * matrix of the worst causality violation seen by each observer (column)
+ * of stamps from each publisher (row).
+ *
+ * Returns zero on success, nonzero on failure.
+ */
+int pingpong_run(struct clockspec clkid, const uint32_t *cpus, uint32_t cpu_count)
+{
+    struct pingpong_seen *matrix, seen[2];
+    uint64_t violations = 0, handoffs = 0, worst = 0;
+    uint32_t a, b, worst_from = 0, worst_to = 0;
+
+    matrix = calloc((size_t)cpu_count * cpu_count, sizeof(struct pingpong_seen));
+    if (!matrix)
+        return 1;
+
+    for (a = 0; a < cpu_count; a++) {
+        for (b = a + 1; b < cpu_count; b++) {
+            memset(seen, 0, sizeof(seen));
+            if (pingpong_pair(clkid, cpus[a], cpus[b], pingpong_side, &seen[0], &seen[1])) {
+                printf("error: could not run threads on CPUs %" PRIu32 " and %" PRIu32 "\n",
+                       cpus[a], cpus[b]);
+                free(matrix);
+                return 1;
+            }
+            /* Row is the publisher, column the observer. */
+            matrix[b * cpu_count + a] = seen[0];
+            matrix[a * cpu_count + b] = seen[1];
+            handoffs += 2 * PINGPONG_ROUNDS;
+        }
+    }
+
+    printf("Worst violation (ns), publisher in rows, observer in columns:\n\n%5s", "");
+    for (b = 0; b < cpu_count; b++)
+        printf(" %7" PRIu32, cpus[b]);
+    printf("\n");
+    for (a = 0; a < cpu_count; a++) {
+        printf("%5" PRIu32, cpus[a]);
+        for (b = 0; b < cpu_count; b++) {
+            const struct pingpong_seen *cell = &matrix[a * cpu_count + b];
+
+            if (a == b)
+                printf(" %7s", "-");
+            else if (!cell->violations)
+                printf(" %7s", ".");
+            else
+                printf(" %7" PRIu64, cell->worst);
+
+            violations += cell->violations;
+            if (cell->worst > worst) {
+                worst = cell->worst;
+                worst_from = cpus[a];
+                worst_to = cpus[b];
+            }
+        }
+        printf("\n");
+    }
+
+    printf("\n%" PRIu64 " violations in %" PRIu64 " handoffs", violations, handoffs);
+    if (violations)
+        printf(", worst %" PRIu64 " ns (CPU %" PRIu32 " to CPU %" PRIu32 ")",
+               worst, worst_from, worst_to);
+    printf("\n");
+
+    free(matrix);
+    return 0;
+}
+
+/*
+ * The size of one tick of a clock in ns, which every timestamp can be off by.
+ * This is the resolution the clock reports, if it reports one. Otherwise it's
+ * the smallest step seen between readings, or zero if the clock never moved.
+ */
+static uint64_t offset_tick(struct clockspec clk)
+{
+    uint64_t hz, prev, now, tick = 0;
+    uint32_t i, ticks;
+
+    if (!clock_resolution(clk, &hz) && hz)
+        return (1000000000ULL + hz - 1) / hz;
+
+    clock_read(clk, &prev);
+    for (ticks = 0; ticks < 4; ticks++) {
+        for (i = 0; i < TICK_MAX_READS; i++) {
+            clock_read(clk, &now);
+            if (now != prev)
+                break;
+        }
+        if (now > prev && (!tick || now - prev < tick))
+            tick = now - prev;
+        prev = now;
+    }
+    return tick;
+}
+
+/*
+ * Estimate the offset between every pair of the given CPUs' views of the
+ * clock, and print it as a matrix, along with the error bounds and the
+ * offsets between sockets.
+ *
+ * Returns zero on success, nonzero on failure.
+ */
+int offset_run(struct clockspec clkid, const uint32_t *cpus, uint32_t cpu_count)
+{
+    struct offset_est *matrix, est, unused;
+    uint64_t tick = offset_tick(clkid);
+    int32_t *package, packages = 0;
+    uint32_t a, b;
+    int32_t pa, pb;
+    int ret = 1;
+
+    matrix = calloc((size_t)cpu_count * cpu_count, sizeof(struct offset_est));
+    package = malloc(cpu_count * sizeof(int32_t));
+    if (!matrix || !package)
+        goto cleanup;
+
+    for (a = 0; a < cpu_count; a++) {
+        package[a] = thread_cpu_package(cpus[a]);
+        if (package[a] >= packages)
+            packages = package[a] + 1;
+    }
+
+    for (a = 0; a < cpu_count; a++) {
+        for (b = a + 1; b < cpu_count; b++) {
+            if (pingpong_pair(clkid, cpus[a], cpus[b], offset_side, &est, &unused)) {
+                printf("error: could not run threads on CPUs %" PRIu32 " and %" PRIu32 "\n",
+                       cpus[a], cpus[b]);
+                goto cleanup;
+            }
+            /* Row is the reference, column the CPU whose offset it is. */
+            matrix[a * cpu_count + b] = est;
+            est.offset = -est.offset;
+            matrix[b * cpu_count + a] = est;
+        }
+    }
+
+    printf("Offset (ns) of each column's clock from each row's (? if no round was usable):\n\n%5s", "");
+    for (b = 0; b < cpu_count; b++)
+        printf(" %7" PRIu32, cpus[b]);
+    printf("\n");
+    for (a = 0; a < cpu_count; a++) {
+        printf("%5" PRIu32, cpus[a]);
+        for (b = 0; b < cpu_count; b++) {
+            if (a == b)
+                printf(" %7s", "-");
+            else if (matrix[a * cpu_count + b].delay == UINT64_MAX)
+                printf(" %7s", "?");
+            else
+                printf(" %7" PRId64, matrix[a * cpu_count + b].offset);
+        }
+        printf("\n");
+    }
+
+    printf("\nError bound (+/- ns, half the round trip plus a %" PRIu64 " ns tick):\n\n%5s",
+           tick, "");
+    for (b = 0; b < cpu_count; b++)
+        printf(" %7" PRIu32, cpus[b]);
+    printf("\n");
+    for (a = 0; a < cpu_count; a++) {
+        printf("%5" PRIu32, cpus[a]);
+        for (b = 0; b < cpu_count; b++) {
+            if (a == b)
+                printf(" %7s", "-");
+            else if (matrix[a * cpu_count + b].delay == UINT64_MAX)
+                printf(" %7s", "?");
+            else
+                printf(" %7" PRIu64, (matrix[a * cpu_count + b].delay + 1) / 2 + tick);
+        }
+        printf("\n");
+    }
+
+    /*
+     * Average the offsets of every CPU pair spanning two sockets, which is
+     * where skew between separately clocked packages shows up. Socket pairs
+     * without a usable CPU pair are left out, and so is the whole section if
+     * that's all of them, e.g. with a single CPU.
+     */
+    if (packages > 0) {
+        int header = 0;
+
+        for (pa = 0; pa < packages; pa++) {
+            for (pb = 0; pb < packages; pb++) {
+                double sum = 0.0, error = 0.0;
+                int64_t worst = 0;
+                uint32_t n = 0;
+
+                for (a = 0; a < cpu_count; a++) {
+                    for (b = 0; b < cpu_count; b++) {
+                        const struct offset_est *cell = &matrix[a * cpu_count + b];
+
+                        if (a == b || package[a] != pa || package[b] != pb
+                            || cell->delay == UINT64_MAX)
+                            continue;
+                        sum += (double)cell->offset;
+                        error += (double)cell->delay / 2.0 + (double)tick;
+                        if (llabs(cell->offset) > llabs(worst))
+                            worst = cell->offset;
+                        n++;
+                    }
+                }
+                if (!n)
+                    continue;
+                if (!header) {
+                    printf("\nBy socket (mean / worst offset, mean error bound, ns):\n\n");
+                    header = 1;
+                }
+                printf("%9s %2" PRId32 " -> %2" PRId32 ": %9.1lf %9" PRId64 " %9.1lf\n",
+                       "socket", pa, pb, sum / n, worst, error / n);
+            }
+        }
+    }
+
+    ret = 0;
+
+cleanup:
+    free(matrix);
+    free(package);
+    return ret;
+}
+
+#endif
+
+/* vim: set ts=4 sts=4 sw=4 et: */
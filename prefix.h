@@ -52,7 +52,11 @@
 
 #ifdef TARGET_OS_LINUX
 #include <sys/resource.h>
+#include <sys/syscall.h>
 #define HAVE_GETRUSAGE
+#ifdef SYS_clock_gettime
+#define HAVE_SYSCALL_GETTIME
+#endif
 #endif
 
 #ifdef TARGET_OS_WINDOWS
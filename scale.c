@@ -0,0 +1,263 @@
+/*
+ * clockperf
+ *
+ * Copyright (c) 2016-2021, Steven Noonan <steven@uplinklabs.net>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ */
+
+#include "prefix.h"
+#include "affinity.h"
+#include "clock.h"
+#include "hist.h"
+#include "scale.h"
+#include "sync.h"
+
+#ifdef HAVE_SCALE_TESTS
+
+/*
+ * Readings taken between checks of the reference clock for the deadline.
+ */
+#define SCALE_BATCH 256
+
+/*
+ * Most readings each thread keeps per step, and the most memory all threads'
+ * buffers may take together. A step ends early if its buffer fills up.
+ */
+#define SCALE_MAX_READS (1U << 20)
+#define SCALE_MAX_BYTES (256U << 20)
+
+/*
+ * Each thread's context gets its own pair of cache lines, so the
+ * adjacent-line prefetcher doesn't drag a neighbour's along with it.
+ */
+#define SCALE_SLOT_ALIGN 128
+
+/*
+ * 'go' is set to the number of threads taking part in a step once they've
+ * all been started, and 'stopped' is a barrier for when they're done
+ * reading.
+ */
+struct scale_cfg {
+    struct clockspec clk;
+    struct clockspec ref;
+    uint32_t step_ms;
+    uint32_t max_reads;
+
+    SYNC_ALIGN(SCALE_SLOT_ALIGN) sync_u32 go;
+    SYNC_ALIGN(SCALE_SLOT_ALIGN) sync_u32 stopped;
+};
+
+struct thread_ctx {
+    SYNC_ALIGN(SCALE_SLOT_ALIGN) struct hist *gaps;
+    uint64_t *capture;
+    uint64_t reads;
+    uint64_t elapsed;
+
+    /* Set if the thread couldn't be pinned, or the clock couldn't be read. */
+    int bind_failed;
+    int read_failed;
+
+    struct thread_handle thread;
+    struct scale_cfg *cfg;
+    uint32_t cpu;
+};
+
+/*
+ * Read the clock back to back for one step into the thread's buffer with
+ * clock_read_n(), counting the readings. Nothing else happens between
+ * readings, so the histogram is left for scale_gaps(). If the clock can't be
+ * read that way, the step ends with no readings.
+ */
+static void scale_thread(const struct scale_cfg *cfg, struct thread_ctx *ctx)
+{
+    uint64_t start, now, deadline;
+
+    ctx->reads = 0;
+    ctx->elapsed = 0;
+
+    clock_read(cfg->ref, &start);
+    deadline = start + (uint64_t)cfg->step_ms * 1000000ULL;
+    do {
+        if (clock_read_n(cfg->clk, ctx->capture + ctx->reads, SCALE_BATCH)) {
+            ctx->read_failed = 1;
+            return;
+        }
+        ctx->reads += SCALE_BATCH;
+        clock_read(cfg->ref, &now);
+    } while (now < deadline && ctx->reads + SCALE_BATCH <= cfg->max_reads);
+
+    ctx->elapsed = now - start;
+}
+
+/*
+ * Record the gaps between consecutive readings of a step, which for a clock
+ * that advances on every read is the latency of a single read. The gaps
+ * across a check of the reference clock are left out.
+ */
+static void scale_gaps(struct thread_ctx *ctx)
+{
+    uint64_t i;
+
+    for (i = 1; i < ctx->reads; i++) {
+        if (i % SCALE_BATCH == 0)
+            continue;
+        if (ctx->capture[i] >= ctx->capture[i - 1])
+            hist_record(ctx->gaps, ctx->capture[i] - ctx->capture[i - 1]);
+    }
+}
+
+/*
+ * One thread's part in a step, pinned to its own CPU. The first thread runs
+ * it on the calling thread, once it has started the others. A thread that
+ * can't be pinned still takes part, so the others aren't left waiting, but
+ * the step isn't reported.
+ */
+static void scale_worker(void *arg)
+{
+    struct thread_ctx *ctx = (struct thread_ctx *)arg;
+    struct scale_cfg *cfg = ctx->cfg;
+    uint32_t active;
+
+    ctx->bind_failed = thread_bind(ctx->cpu);
+
+    /* Start reading together, so every thread contends with the rest. */
+    active = sync_wait(&cfg->go, 0, SYNC_SPIN_LIMIT);
+
+    scale_thread(cfg, ctx);
+
+    /* Only once every thread has stopped reading. */
+    sync_barrier(&cfg->stopped, active);
+
+    scale_gaps(ctx);
+}
+
+void scale_run(uint32_t step_ms, struct clockspec clkid, struct clockspec refid,
+               const uint32_t *cpus, uint32_t max_threads)
+{
+    uint32_t idx, count;
+    struct thread_ctx *threads = NULL;
+    void *threads_buf;
+    struct hist *all;
+    struct scale_cfg *cfg_buf, *cfg;
+
+    /* Its control words are aligned, so it's allocated like the contexts. */
+    cfg_buf = calloc(2, sizeof(struct scale_cfg));
+    if (!cfg_buf)
+        return;
+    cfg = (struct scale_cfg *)(((uintptr_t)cfg_buf + SCALE_SLOT_ALIGN - 1)
+                               & ~(uintptr_t)(SCALE_SLOT_ALIGN - 1));
+
+    cfg->clk = clkid;
+    cfg->ref = refid;
+    cfg->step_ms = step_ms;
+    cfg->max_reads = SCALE_MAX_BYTES / sizeof(uint64_t) / max_threads;
+    if (cfg->max_reads > SCALE_MAX_READS)
+        cfg->max_reads = SCALE_MAX_READS;
+    if (cfg->max_reads < SCALE_BATCH)
+        cfg->max_reads = SCALE_BATCH;
+
+    /* calloc() doesn't promise more than 16-byte alignment. */
+    threads_buf = calloc(max_threads + 1, sizeof(struct thread_ctx));
+    all = malloc(sizeof(struct hist));
+    if (!threads_buf || !all)
+        goto cleanup;
+    threads = (struct thread_ctx *)(((uintptr_t)threads_buf + SCALE_SLOT_ALIGN - 1)
+                                    & ~(uintptr_t)(SCALE_SLOT_ALIGN - 1));
+    for (idx = 0; idx < max_threads; idx++) {
+        threads[idx].gaps = malloc(sizeof(struct hist));
+        threads[idx].capture = malloc(cfg->max_reads * sizeof(uint64_t));
+        if (!threads[idx].gaps || !threads[idx].capture)
+            goto cleanup;
+
+        /* Fault the buffer in now, rather than while the clock is read. */
+        memset(threads[idx].capture, 0, cfg->max_reads * sizeof(uint64_t));
+    }
+
+    printf("%7s %13s %9s %8s %8s %8s %10s\n",
+           "Threads", "Reads/s", "Cost(ns)", "p50", "p99", "p99.9", "max");
+
+    /* Double the number of threads each step, finishing with all the CPUs. */
+    for (count = 1; ; count = count * 2 < max_threads ? count * 2 : max_threads) {
+        uint32_t active;
+        double rate = 0.0, cost = 0.0;
+
+        sync_init(&cfg->go, 0);
+        sync_init(&cfg->stopped, 0);
+        for (idx = 0; idx < count; idx++) {
+            hist_init(threads[idx].gaps);
+            threads[idx].cfg = cfg;
+            threads[idx].cpu = cpus[idx];
+            threads[idx].bind_failed = 0;
+            threads[idx].read_failed = 0;
+        }
+
+        /* If a thread can't be started, the step goes ahead with fewer. */
+        for (active = 1; active < count; active++) {
+            if (thread_start(&threads[active].thread, scale_worker, &threads[active]))
+                break;
+        }
+        sync_store(&cfg->go, active);
+        sync_wake(&cfg->go);
+
+        scale_worker(&threads[0]);
+        for (idx = 1; idx < active; idx++)
+            thread_join(&threads[idx].thread);
+
+        for (idx = 0; idx < active; idx++) {
+            if (threads[idx].bind_failed) {
+                printf("error: could not bind scale thread to CPU%" PRIu32 "\n",
+                       threads[idx].cpu);
+                goto cleanup;
+            }
+            if (threads[idx].read_failed) {
+                printf("%7s (no read loop for this clock, unavailable)\n", "");
+                goto cleanup;
+            }
+        }
+
+        hist_init(all);
+        for (idx = 0; idx < active; idx++) {
+            struct thread_ctx *ctx = &threads[idx];
+
+            hist_merge(all, ctx->gaps);
+            rate += (double)ctx->reads * 1e9 / (double)ctx->elapsed;
+            cost += (double)ctx->elapsed / (double)ctx->reads;
+        }
+        cost /= active;
+
+        printf("%7" PRIu32 " %13.0lf %9.2lf %8" PRIu64 " %8" PRIu64 " %8" PRIu64 " %10" PRIu64 "\n",
+               active, rate, cost,
+               hist_percentile(all, 50.0), hist_percentile(all, 99.0),
+               hist_percentile(all, 99.9), all->max);
+
+        if (count == max_threads)
+            break;
+    }
+
+cleanup:
+    if (threads) {
+        for (idx = 0; idx < max_threads; idx++) {
+            free(threads[idx].gaps);
+            free(threads[idx].capture);
+        }
+    }
+    free(threads_buf);
+    free(all);
+    free(cfg_buf);
+}
+
+#endif
+
+/* vim: set ts=4 sts=4 sw=4 et: */
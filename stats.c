@@ -0,0 +1,245 @@
+/*
+ * clockperf
+ *
+ * Copyright (c) 2016-2021, Steven Noonan <steven@uplinklabs.net>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ */
+
+#include "prefix.h"
+#include "stats.h"
+
+void linreg_init(struct linreg *r)
+{
+    memset(r, 0, sizeof(*r));
+}
+
+void linreg_add(struct linreg *r, double x, double y)
+{
+    double dx, dy;
+
+    r->n++;
+    dx = x - r->mean_x;
+    dy = y - r->mean_y;
+    r->mean_x += dx / (double)r->n;
+    r->mean_y += dy / (double)r->n;
+    r->m2_x += dx * (x - r->mean_x);
+    r->m2_y += dy * (y - r->mean_y);
+    r->c_xy += dx * (y - r->mean_y);
+}
+
+/*
+ * Solve for the least-squares line through the accumulated samples. Needs at
+ * least three samples with some spread in x, since the residual variance
+ * has n - 2 degrees of freedom.
+ */
+int linreg_solve(const struct linreg *r, struct linreg_fit *fit)
+{
+    double sse;
+
+    if (r->n < 3 || r->m2_x <= 0.0)
+        return 1;
+
+    fit->slope = r->c_xy / r->m2_x;
+    fit->intercept = r->mean_y - fit->slope * r->mean_x;
+
+    sse = r->m2_y - fit->slope * r->c_xy;
+    if (sse < 0.0)
+        sse = 0.0;
+    fit->resid_stddev = sqrt(sse / (double)(r->n - 2));
+    fit->slope_stderr = fit->resid_stddev / sqrt(r->m2_x);
+    fit->intercept_stderr = fit->resid_stddev
+        * sqrt(1.0 / (double)r->n + r->mean_x * r->mean_x / r->m2_x);
+    return 0;
+}
+
+/*
+ * Continued fraction for the regularized incomplete beta function, by the
+ * modified Lentz method (Numerical Recipes, betacf).
+ */
+static double incbeta_cf(double a, double b, double x)
+{
+    const double tiny = 1e-300;
+    double c, d, h, aa, del;
+    int m, m2;
+
+    c = 1.0;
+    d = 1.0 - (a + b) * x / (a + 1.0);
+    if (fabs(d) < tiny)
+        d = tiny;
+    d = 1.0 / d;
+    h = d;
+    for (m = 1; m <= 10000; m++) {
+        m2 = 2 * m;
+        aa = m * (b - m) * x / ((a - 1.0 + m2) * (a + m2));
+        d = 1.0 + aa * d;
+        if (fabs(d) < tiny)
+            d = tiny;
+        c = 1.0 + aa / c;
+        if (fabs(c) < tiny)
+            c = tiny;
+        d = 1.0 / d;
+        h *= d * c;
+        aa = -(a + m) * (a + b + m) * x / ((a + m2) * (a + 1.0 + m2));
+        d = 1.0 + aa * d;
+        if (fabs(d) < tiny)
+            d = tiny;
+        c = 1.0 + aa / c;
+        if (fabs(c) < tiny)
+            c = tiny;
+        d = 1.0 / d;
+        del = d * c;
+        h *= del;
+        if (fabs(del - 1.0) < 1e-15)
+            break;
+    }
+    return h;
+}
+
+/*
+ * Regularized incomplete beta function I_x(a, b).
+ */
+static double incbeta(double a, double b, double x)
+{
+    double bt;
+
+    if (x <= 0.0)
+        return 0.0;
+    if (x >= 1.0)
+        return 1.0;
+
+    bt = exp(lgamma(a + b) - lgamma(a) - lgamma(b) + a * log(x) + b * log(1.0 - x));
+    if (x < (a + 1.0) / (a + b + 2.0))
+        return bt * incbeta_cf(a, b, x) / a;
+    return 1.0 - bt * incbeta_cf(b, a, 1.0 - x) / b;
+}
+
+/*
+ * Cumulative distribution function of Student's t distribution.
+ */
+double stats_t_cdf(double t, uint64_t dof)
+{
+    double v = (double)dof;
+    double tail = 0.5 * incbeta(v / 2.0, 0.5, v / (v + t * t));
+
+    return t >= 0.0 ? 1.0 - tail : tail;
+}
+
+/*
+ * Quantile of Student's t distribution, i.e. the t for which
+ * stats_t_cdf(t, dof) == p, found by bisection.
+ */
+double stats_t_quantile(double p, uint64_t dof)
+{
+    double lo = 0.0, hi = 1.0, mid;
+    int i;
+
+    if (!dof || p >= 1.0)
+        return INFINITY;
+    if (p <= 0.0)
+        return -INFINITY;
+    if (p < 0.5)
+        return -stats_t_quantile(1.0 - p, dof);
+
+    while (stats_t_cdf(hi, dof) < p && hi < 1e12) {
+        lo = hi;
+        hi *= 2.0;
+    }
+    for (i = 0; i < 200 && hi - lo > 1e-12 * hi; i++) {
+        mid = 0.5 * (lo + hi);
+        if (stats_t_cdf(mid, dof) < p)
+            lo = mid;
+        else
+            hi = mid;
+    }
+    return 0.5 * (lo + hi);
+}
+
+/*
+ * Multiplier for the half-width of a two-sided confidence interval at the
+ * given confidence level, in percent (e.g. 95).
+ */
+double stats_t_interval(double confidence, uint64_t dof)
+{
+    return stats_t_quantile(0.5 + confidence / 200.0, dof);
+}
+
+/*
+ * Find the k-th smallest (from zero) of 'n' values in expected O(n) time,
+ * with quickselect. The array is partially reordered, such that everything
+ * before index k is no larger and everything after it no smaller.
+ */
+double stats_select(double *v, size_t n, size_t k)
+{
+    size_t lo = 0, hi = n - 1;
+
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2, i, j;
+        double pivot, tmp;
+
+        /* Median of three, so sorted input doesn't go quadratic. */
+        if (v[mid] < v[lo]) { tmp = v[mid]; v[mid] = v[lo]; v[lo] = tmp; }
+        if (v[hi] < v[lo]) { tmp = v[hi]; v[hi] = v[lo]; v[lo] = tmp; }
+        if (v[hi] < v[mid]) { tmp = v[hi]; v[hi] = v[mid]; v[mid] = tmp; }
+        pivot = v[mid];
+
+        i = lo;
+        j = hi;
+        while (i <= j) {
+            while (v[i] < pivot)
+                i++;
+            while (v[j] > pivot)
+                j--;
+            if (i <= j) {
+                tmp = v[i]; v[i] = v[j]; v[j] = tmp;
+                i++;
+                if (j == 0)
+                    break;
+                j--;
+            }
+        }
+
+        if (k <= j)
+            hi = j;
+        else if (k >= i)
+            lo = i;
+        else
+            break;
+    }
+    return v[k];
+}
+
+/*
+ * Median of 'n' values, averaging the middle two if 'n' is even. Reorders
+ * the array.
+ */
+double stats_median(double *v, size_t n)
+{
+    double lower, upper;
+    size_t i;
+
+    if (!n)
+        return NAN;
+    upper = stats_select(v, n, n / 2);
+    if (n % 2)
+        return upper;
+
+    /* Everything below n / 2 is no larger, so the lower middle is the max. */
+    lower = v[0];
+    for (i = 1; i < n / 2; i++)
+        lower = fmax(lower, v[i]);
+    return 0.5 * (lower + upper);
+}
+
+/* vim: set ts=4 sts=4 sw=4 et: */
@@ -0,0 +1,60 @@
+/*
+ * clockperf
+ *
+ * Copyright (c) 2016-2021, Steven Noonan <steven@uplinklabs.net>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ */
+
+#pragma once
+
+#include "platform.h"
+
+/*
+ * Online simple linear regression of y on x. Means and co-moments are
+ * accumulated Welford-style, so samples can be added one at a time without
+ * losing precision to large sums.
+ */
+struct linreg {
+    uint64_t n;
+    double mean_x;
+    double mean_y;
+    double m2_x;
+    double m2_y;
+    double c_xy;
+};
+
+/*
+ * The result of a least-squares fit y = intercept + slope * x.
+ */
+struct linreg_fit {
+    double slope;
+    double intercept;
+    double slope_stderr;
+    double intercept_stderr;
+    double resid_stddev;
+};
+
+void linreg_init(struct linreg *r);
+void linreg_add(struct linreg *r, double x, double y);
+int linreg_solve(const struct linreg *r, struct linreg_fit *fit);
+
+double stats_t_cdf(double t, uint64_t dof);
+double stats_t_quantile(double p, uint64_t dof);
+double stats_t_interval(double confidence, uint64_t dof);
+
+double stats_select(double *v, size_t n, size_t k);
+double stats_median(double *v, size_t n);
+
+/* vim: set ts=4 sts=4 sw=4 et: */
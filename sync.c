@@ -0,0 +1,87 @@
+/*
+ * clockperf
+ *
+ * Copyright (c) 2016-2021, Steven Noonan <steven@uplinklabs.net>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ */
+
+#include "prefix.h"
+#include "sync.h"
+#include "util.h"
+
+#ifdef HAVE_SYNC
+
+#ifdef TARGET_OS_LINUX
+#include <limits.h>
+#include <linux/futex.h>
+#endif
+
+/*
+ * Wait for the word to move on from 'seen', spinning up to 'spins' times
+ * first and then sleeping on it. Sleeping uses a futex on Linux, so a
+ * sync_wake() wakes the waiter right away, and is a short sleep elsewhere.
+ * Returns the new value.
+ */
+uint32_t sync_wait(sync_u32 *word, uint32_t seen, uint32_t spins)
+{
+    uint32_t now, i;
+
+    for (i = 0; i < spins; i++) {
+        now = sync_load(word);
+        if (now != seen)
+            return now;
+        cpu_relax();
+    }
+    while ((now = sync_load(word)) == seen) {
+#ifdef TARGET_OS_LINUX
+        syscall(SYS_futex, (uint32_t *)word, FUTEX_WAIT_PRIVATE, seen, NULL, NULL, 0);
+#else
+        thread_sleep(100);
+#endif
+    }
+    return now;
+}
+
+/*
+ * Wake everything sleeping in sync_wait() on the word, after changing it.
+ */
+void sync_wake(sync_u32 *word)
+{
+#ifdef TARGET_OS_LINUX
+    syscall(SYS_futex, (uint32_t *)word, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+#else
+    (void)word;
+#endif
+}
+
+/*
+ * Wait until 'count' threads have arrived at a barrier. The word must start
+ * out as zero, and can only be used once.
+ */
+void sync_barrier(sync_u32 *word, uint32_t count)
+{
+    uint32_t now = sync_add(word, 1) + 1;
+
+    if (now >= count) {
+        sync_wake(word);
+        return;
+    }
+    while (now < count)
+        now = sync_wait(word, now, SYNC_SPIN_LIMIT);
+}
+
+#endif
+
+/* vim: set ts=4 sts=4 sw=4 et: */
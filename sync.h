@@ -0,0 +1,124 @@
+/*
+ * clockperf
+ *
+ * Copyright (c) 2016-2021, Steven Noonan <steven@uplinklabs.net>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ */
+
+#pragma once
+
+#include "platform.h"
+
+/*
+ * The atomics the multi-threaded tests hand work back and forth with: C11
+ * <stdatomic.h> where the compiler has it, and the Interlocked functions
+ * with MSVC, which doesn't.
+ */
+#if defined(TARGET_COMPILER_MSVC)
+#  define HAVE_SYNC
+#  include <intrin.h>
+#elif defined(__STDC_VERSION__) && __STDC_VERSION__ >= 201112L && !defined(__STDC_NO_ATOMICS__)
+#  define HAVE_SYNC
+#  include <stdalign.h>
+#  include <stdatomic.h>
+#endif
+
+#ifdef HAVE_SYNC
+
+/*
+ * Spins sync_wait() and sync_barrier() callers use when they have nothing
+ * better to go by.
+ */
+#define SYNC_SPIN_LIMIT (1U << 18)
+
+#ifdef TARGET_COMPILER_MSVC
+#  define SYNC_ALIGN(n) __declspec(align(n))
+typedef volatile long sync_u32;
+#else
+#  define SYNC_ALIGN(n) alignas(n)
+typedef atomic_uint sync_u32;
+#endif
+
+static INLINE void cpu_relax(void)
+{
+#if defined(TARGET_COMPILER_MSVC)
+    YieldProcessor();
+#elif defined(TARGET_COMPILER_GCC) && (defined(TARGET_CPU_X86) || defined(TARGET_CPU_X86_64))
+    __builtin_ia32_pause();
+#elif defined(TARGET_COMPILER_GCC) && defined(TARGET_CPU_ARM)
+    __asm__ __volatile__("yield" ::: "memory");
+#endif
+}
+
+static INLINE void sync_init(sync_u32 *p, uint32_t v)
+{
+#ifdef TARGET_COMPILER_MSVC
+    *p = (long)v;
+#else
+    atomic_init(p, v);
+#endif
+}
+
+/*
+ * Load with acquire semantics, so whatever was written before the matching
+ * sync_store() is visible afterward. On x86, every load already is one.
+ */
+static INLINE uint32_t sync_load(sync_u32 *p)
+{
+#if defined(TARGET_COMPILER_MSVC) && (defined(TARGET_CPU_X86) || defined(TARGET_CPU_X86_64))
+    uint32_t v = (uint32_t)*p;
+    _ReadWriteBarrier();
+    return v;
+#elif defined(TARGET_COMPILER_MSVC)
+    return (uint32_t)InterlockedCompareExchange(p, 0, 0);
+#else
+    return atomic_load_explicit(p, memory_order_acquire);
+#endif
+}
+
+/*
+ * Store with release semantics, publishing everything written before it.
+ */
+static INLINE void sync_store(sync_u32 *p, uint32_t v)
+{
+#if defined(TARGET_COMPILER_MSVC) && (defined(TARGET_CPU_X86) || defined(TARGET_CPU_X86_64))
+    _ReadWriteBarrier();
+    *p = (long)v;
+#elif defined(TARGET_COMPILER_MSVC)
+    InterlockedExchange(p, (long)v);
+#else
+    atomic_store_explicit(p, v, memory_order_release);
+#endif
+}
+
+/*
+ * Add to the value and return what it was before.
+ */
+static INLINE uint32_t sync_add(sync_u32 *p, uint32_t v)
+{
+#ifdef TARGET_COMPILER_MSVC
+    return (uint32_t)InterlockedExchangeAdd(p, (long)v);
+#else
+    return atomic_fetch_add_explicit(p, v, memory_order_acq_rel);
+#endif
+}
+
+uint32_t sync_wait(sync_u32 *word, uint32_t seen, uint32_t spins);
+void sync_wake(sync_u32 *word);
+void sync_barrier(sync_u32 *word, uint32_t count);
+
+#endif
+
+/* vim: set ts=4 sts=4 sw=4 et: */
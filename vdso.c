@@ -0,0 +1,178 @@
+/*
+ * clockperf
+ *
+ * Copyright (c) 2016-2021, Steven Noonan <steven@uplinklabs.net>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ */
+
+#include "prefix.h"
+#include "vdso.h"
+
+#ifdef HAVE_VDSO
+
+#include <elf.h>
+#include <link.h>
+#include <sys/auxv.h>
+
+vdso_clock_gettime_fn vdso_clock_gettime;
+vdso_gettimeofday_fn vdso_gettimeofday;
+vdso_time_fn vdso_time;
+
+struct vdso_image {
+    uintptr_t load_offset;
+    const ElfW(Sym) *symtab;
+    const char *strtab;
+    uint32_t nsyms;
+};
+
+/*
+ * Count the symbols in the dynamic symbol table using DT_GNU_HASH. The
+ * highest symbol index is found by taking the largest bucket start and
+ * walking its chain to the end marker.
+ */
+static uint32_t gnu_hash_nsyms(const uint32_t *gnu_hash)
+{
+    uint32_t nbuckets = gnu_hash[0];
+    uint32_t symoffset = gnu_hash[1];
+    uint32_t bloom_size = gnu_hash[2];
+    const ElfW(Addr) *bloom = (const ElfW(Addr) *)&gnu_hash[4];
+    const uint32_t *buckets = (const uint32_t *)&bloom[bloom_size];
+    const uint32_t *chain = &buckets[nbuckets];
+    uint32_t i, last = 0;
+
+    for (i = 0; i < nbuckets; i++) {
+        if (buckets[i] > last)
+            last = buckets[i];
+    }
+    if (last < symoffset)
+        return symoffset;
+    while (!(chain[last - symoffset] & 1))
+        last++;
+    return last + 1;
+}
+
+static int vdso_parse(struct vdso_image *image, uintptr_t base)
+{
+    const ElfW(Ehdr) *ehdr = (const ElfW(Ehdr) *)base;
+    const ElfW(Phdr) *phdr;
+    const ElfW(Dyn) *dyn = NULL;
+    const uint32_t *hash = NULL, *gnu_hash = NULL;
+    int found_load = 0;
+    size_t i;
+
+    if (memcmp(ehdr->e_ident, ELFMAG, SELFMAG) != 0)
+        return 1;
+
+    phdr = (const ElfW(Phdr) *)(base + ehdr->e_phoff);
+    for (i = 0; i < ehdr->e_phnum; i++) {
+        if (phdr[i].p_type == PT_LOAD && !found_load) {
+            found_load = 1;
+            image->load_offset = base + phdr[i].p_offset - phdr[i].p_vaddr;
+        } else if (phdr[i].p_type == PT_DYNAMIC) {
+            dyn = (const ElfW(Dyn) *)(base + phdr[i].p_offset);
+        }
+    }
+    if (!found_load || !dyn)
+        return 1;
+
+    image->symtab = NULL;
+    image->strtab = NULL;
+    for (; dyn->d_tag != DT_NULL; dyn++) {
+        uintptr_t addr = image->load_offset + dyn->d_un.d_ptr;
+        switch (dyn->d_tag) {
+        case DT_SYMTAB:
+            image->symtab = (const ElfW(Sym) *)addr;
+            break;
+        case DT_STRTAB:
+            image->strtab = (const char *)addr;
+            break;
+        case DT_HASH:
+            hash = (const uint32_t *)addr;
+            break;
+        case DT_GNU_HASH:
+            gnu_hash = (const uint32_t *)addr;
+            break;
+        }
+    }
+    if (!image->symtab || !image->strtab || (!hash && !gnu_hash))
+        return 1;
+
+    /* The second word of DT_HASH is the number of symbols. */
+    image->nsyms = hash ? hash[1] : gnu_hash_nsyms(gnu_hash);
+    return 0;
+}
+
+static void *vdso_lookup(const struct vdso_image *image, const char *name)
+{
+    uint32_t i;
+
+    for (i = 0; i < image->nsyms; i++) {
+        const ElfW(Sym) *sym = &image->symtab[i];
+
+        if (ELF64_ST_TYPE(sym->st_info) != STT_FUNC)
+            continue;
+        if (ELF64_ST_BIND(sym->st_info) != STB_GLOBAL
+            && ELF64_ST_BIND(sym->st_info) != STB_WEAK)
+            continue;
+        if (sym->st_shndx == SHN_UNDEF)
+            continue;
+        if (strcmp(image->strtab + sym->st_name, name) != 0)
+            continue;
+        return (void *)(image->load_offset + sym->st_value);
+    }
+    return NULL;
+}
+
+/*
+ * The entry points are called __vdso_* on x86, and __kernel_* on arm64.
+ */
+static void *vdso_lookup_any(const struct vdso_image *image, const char *name)
+{
+    char buf[64];
+    void *sym;
+
+    snprintf(buf, sizeof(buf), "__vdso_%s", name);
+    sym = vdso_lookup(image, buf);
+    if (sym)
+        return sym;
+    snprintf(buf, sizeof(buf), "__kernel_%s", name);
+    return vdso_lookup(image, buf);
+}
+
+/*
+ * Find the vDSO the kernel mapped into our address space and resolve its
+ * time functions, so they can be called without going through libc. Any
+ * function which can't be found is left NULL.
+ */
+void vdso_init(void)
+{
+    struct vdso_image image;
+    uintptr_t base;
+
+    base = (uintptr_t)getauxval(AT_SYSINFO_EHDR);
+    if (!base)
+        return;
+
+    if (vdso_parse(&image, base))
+        return;
+
+    vdso_clock_gettime = (vdso_clock_gettime_fn)vdso_lookup_any(&image, "clock_gettime");
+    vdso_gettimeofday = (vdso_gettimeofday_fn)vdso_lookup_any(&image, "gettimeofday");
+    vdso_time = (vdso_time_fn)vdso_lookup_any(&image, "time");
+}
+
+#endif
+
+/* vim: set ts=4 sts=4 sw=4 et: */
@@ -0,0 +1,47 @@
+/*
+ * clockperf
+ *
+ * Copyright (c) 2016-2021, Steven Noonan <steven@uplinklabs.net>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ */
+
+#pragma once
+
+#include "platform.h"
+
+/*
+ * Calling into the vDSO directly only works where the vDSO entry points use
+ * the regular C calling convention (which rules out e.g. PowerPC).
+ */
+#if defined(TARGET_OS_LINUX) \
+    && (defined(TARGET_CPU_X86) \
+        || defined(TARGET_CPU_X86_64) \
+        || (defined(TARGET_CPU_ARM) && TARGET_CPU_BITS == 64))
+#define HAVE_VDSO
+#endif
+
+#ifdef HAVE_VDSO
+typedef int (*vdso_clock_gettime_fn)(clockid_t id, struct timespec *ts);
+typedef int (*vdso_gettimeofday_fn)(struct timeval *tv, void *tz);
+typedef time_t (*vdso_time_fn)(time_t *t);
+
+extern vdso_clock_gettime_fn vdso_clock_gettime;
+extern vdso_gettimeofday_fn vdso_gettimeofday;
+extern vdso_time_fn vdso_time;
+
+void vdso_init(void);
+#endif
+
+/* vim: set ts=4 sts=4 sw=4 et: */